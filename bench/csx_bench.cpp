@@ -0,0 +1,515 @@
+/*
+ * Throughput benchmark for the CSX module.
+ *
+ * Generates synthetic corpora, then times csx:serialize() and csx:parse()
+ * on each of them next to Zorba's own fn:parse-xml() and fn:serialize(),
+ * as well as csx:from-xml() and csx:to-xml(), which skip the XDM. The
+ * parallel functions (csx:serialize-many(), csx:parse-many() and indexed
+ * serialization) are run once for each of PARALLELISM.
+ * Results are written to stdout as one JSON document, so that runs of
+ * different releases can be compared by a script.
+ *
+ *   csx_bench [--path <dir>]... [--size <n>] [--iterations <n>]
+ *             [--corpus <name>]...
+ *
+ * --path adds a directory Zorba searches for modules, schemas and
+ * vocabularies (the build's URI_PATH and LIB_PATH); --size scales the
+ * corpora (default 1000); --iterations is how often each scenario is run
+ * (default 20); --corpus restricts the run to the named corpora.
+ *
+ * Allocations are counted by replacing the global operator new, so memory
+ * obtained with malloc() directly is not included. allocations_per_node
+ * shows what a parse costs beyond the nodes it must create; run with
+ * --size 50000 or more for streams of a million nodes.
+ */
+
+#include <zorba/zorba.h>
+#include <zorba/store_manager.h>
+#include <zorba/item_factory.h>
+#include <zorba/iterator.h>
+#include <zorba/static_context.h>
+#include <zorba/dynamic_context.h>
+#include <zorba/zorba_exception.h>
+
+#ifdef WIN32
+#  include <windows.h>
+#else
+#  include <sys/time.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace zorba;
+using namespace std;
+
+/*******************************************************************************************
+ * Allocation counting
+ *******************************************************************************************/
+
+#if __cplusplus >= 201103L
+#  define BENCH_THROWS_BAD_ALLOC
+#  define BENCH_NOTHROW noexcept
+#else
+#  define BENCH_THROWS_BAD_ALLOC throw(std::bad_alloc)
+#  define BENCH_NOTHROW throw()
+#endif
+
+static volatile uint64_t sAllocations = 0;
+static volatile uint64_t sAllocatedBytes = 0;
+
+static void* countedAlloc(size_t aSize)
+{
+#ifdef __GNUC__
+  __sync_fetch_and_add(&sAllocations, 1);
+  __sync_fetch_and_add(&sAllocatedBytes, aSize);
+#else
+  ++sAllocations;
+  sAllocatedBytes += aSize;
+#endif
+  void* lResult = malloc(aSize ? aSize : 1);
+  if (!lResult) {
+    throw std::bad_alloc();
+  }
+  return lResult;
+}
+
+void* operator new(size_t aSize) BENCH_THROWS_BAD_ALLOC { return countedAlloc(aSize); }
+void* operator new[](size_t aSize) BENCH_THROWS_BAD_ALLOC { return countedAlloc(aSize); }
+void operator delete(void* aPtr) BENCH_NOTHROW { free(aPtr); }
+void operator delete[](void* aPtr) BENCH_NOTHROW { free(aPtr); }
+
+/*******************************************************************************************
+ * Corpora
+ *******************************************************************************************/
+
+namespace {
+
+  struct Corpus {
+    string theName;
+    string theXml;
+    // Prolog and expression turning $xml into the document to encode; the
+    // schema-typed corpus is validated
+    string theProlog;
+    string theLoad;
+    string theVocab;
+  };
+
+  void wide(ostringstream& aOut, size_t aSize)
+  {
+    aOut << "<root>";
+    for (size_t i = 0; i < aSize * 10; ++i) {
+      aOut << "<item>value " << i << "</item>";
+    }
+    aOut << "</root>";
+  }
+
+  void deep(ostringstream& aOut, size_t aSize)
+  {
+    aOut << "<root>";
+    for (size_t i = 0; i < aSize / 10 + 1; ++i) {
+      for (size_t d = 0; d < 100; ++d) {
+        aOut << "<level d=\"" << d << "\">";
+      }
+      aOut << "leaf " << i;
+      for (size_t d = 0; d < 100; ++d) {
+        aOut << "</level>";
+      }
+    }
+    aOut << "</root>";
+  }
+
+  void attributes(ostringstream& aOut, size_t aSize)
+  {
+    aOut << "<root>";
+    for (size_t i = 0; i < aSize; ++i) {
+      aOut << "<record id=\"" << i << "\"";
+      for (size_t a = 0; a < 20; ++a) {
+        aOut << " attr" << a << "=\"v" << (i * 20 + a) << "\"";
+      }
+      aOut << "/>";
+    }
+    aOut << "</root>";
+  }
+
+  void mixed(ostringstream& aOut, size_t aSize)
+  {
+    aOut << "<doc>";
+    for (size_t i = 0; i < aSize; ++i) {
+      aOut << "<p>Paragraph " << i << " has <b>bold</b>, <i>italic</i> and "
+           << "<a href=\"#n" << i << "\">linked</a> text<!-- note " << i
+           << " --> in it.</p>";
+    }
+    aOut << "</doc>";
+  }
+
+  void typed(ostringstream& aOut, size_t aSize)
+  {
+    aOut << "<foo:Emps xmlns:foo=\"http://www.opencsx.org/schema\">";
+    for (size_t i = 0; i < aSize * 5; ++i) {
+      aOut << "<foo:Employee><foo:Name>Employee " << i << "</foo:Name>"
+           << "<foo:Salary>" << (30000 + i * 7) << "</foo:Salary></foo:Employee>";
+    }
+    aOut << "</foo:Emps>";
+  }
+
+  // Values OpenCSX has no native form for, which are written as strings
+  void dates(ostringstream& aOut, size_t aSize)
+  {
+    aOut << "<t:Ledger xmlns:t=\"http://www.opencsx.org/schema/types\">" << setfill('0');
+    for (size_t i = 0; i < aSize * 5; ++i) {
+      size_t lYear = 2000 + i / 336;
+      size_t lMonth = 1 + i / 28 % 12;
+      size_t lDay = 1 + i % 28;
+      aOut << "<t:Entry><t:Date>" << lYear << "-" << setw(2) << lMonth << "-"
+           << setw(2) << lDay << "</t:Date><t:Time>" << lYear << "-" << setw(2) << lMonth
+           << "-" << setw(2) << lDay << "T" << setw(2) << i % 24 << ":" << setw(2) << i % 60
+           << ":00Z</t:Time><t:Amount>" << i / 100 << "." << setw(2) << i % 100
+           << "</t:Amount></t:Entry>";
+    }
+    aOut << "</t:Ledger>";
+  }
+
+  void makeCorpora(size_t aSize, vector<Corpus>& aCorpora)
+  {
+    struct Generator {
+      const char* theName;
+      void (*theGenerate)(ostringstream&, size_t);
+    };
+    static const Generator lGenerators[] = {
+      { "wide", &wide },
+      { "deep", &deep },
+      { "attributes", &attributes },
+      { "mixed", &mixed },
+      { "typed", &typed },
+      { "dates", &dates }
+    };
+
+    for (size_t i = 0; i < sizeof(lGenerators) / sizeof(lGenerators[0]); ++i) {
+      ostringstream lXml;
+      lGenerators[i].theGenerate(lXml, aSize);
+      Corpus lCorpus;
+      lCorpus.theName = lGenerators[i].theName;
+      lCorpus.theXml = lXml.str();
+      lCorpus.theLoad = "fn:parse-xml($xml)";
+      if (lCorpus.theName == "typed") {
+        lCorpus.theProlog =
+          "import schema namespace foo = \"http://www.opencsx.org/schema\";\n";
+        lCorpus.theLoad = "validate { fn:parse-xml($xml) }";
+        lCorpus.theVocab = "http://www.opencsx.org/vocab";
+      }
+      else if (lCorpus.theName == "dates") {
+        lCorpus.theProlog =
+          "import schema namespace t = \"http://www.opencsx.org/schema/types\";\n";
+        lCorpus.theLoad = "validate { fn:parse-xml($xml) }";
+      }
+      aCorpora.push_back(lCorpus);
+    }
+  }
+
+  /*******************************************************************************************
+   * Running queries
+   *******************************************************************************************/
+
+  uint64_t now()
+  {
+#ifdef WIN32
+    LARGE_INTEGER lFrequency;
+    LARGE_INTEGER lNow;
+    QueryPerformanceFrequency(&lFrequency);
+    QueryPerformanceCounter(&lNow);
+    return (uint64_t)(lNow.QuadPart * 1000000.0 / lFrequency.QuadPart);
+#else
+    struct timeval lNow;
+    gettimeofday(&lNow, 0);
+    return (uint64_t)lNow.tv_sec * 1000000 + lNow.tv_usec;
+#endif
+  }
+
+  // Thread counts the parallel scenarios are run with
+  const unsigned PARALLELISM[] = { 1, 2, 4, 8 };
+
+  // Copies of the corpus csx:serialize-many() and csx:parse-many() get, so
+  // that every thread has one
+  const size_t MANY_COPIES = 8;
+
+  class Bench {
+    public:
+      Bench(Zorba* aZorba, const vector<String>& aPaths, size_t aIterations)
+        : theZorba(aZorba), thePaths(aPaths), theIterations(aIterations) {}
+
+      XQuery_t compile(const string& aQuery)
+      {
+        StaticContext_t lContext = theZorba->createStaticContext();
+        if (!thePaths.empty()) {
+          lContext->setModulePaths(thePaths);
+        }
+        return theZorba->compileQuery(aQuery, lContext);
+      }
+
+      // Runs aQuery once and returns its only result
+      Item evaluate(XQuery_t aQuery)
+      {
+        Item lResult;
+        Iterator_t lIter = aQuery->iterator();
+        lIter->open();
+        lIter->next(lResult);
+        lIter->close();
+        return lResult;
+      }
+
+      // Runs aQuery theIterations times and writes a JSON scenario object
+      void scenario(ostream& aOut, const char* aName, XQuery_t aQuery,
+                    size_t aBytes, uint64_t aNodes, bool aFirst)
+      {
+        // One warm-up run, so that one-time costs such as loading the
+        // vocabulary are not measured
+        evaluate(aQuery);
+
+        uint64_t lAllocations = sAllocations;
+        uint64_t lAllocatedBytes = sAllocatedBytes;
+        uint64_t lStart = now();
+        for (size_t i = 0; i < theIterations; ++i) {
+          evaluate(aQuery);
+        }
+        double lSeconds = (now() - lStart) / 1000000.0;
+        lAllocations = sAllocations - lAllocations;
+        lAllocatedBytes = sAllocatedBytes - lAllocatedBytes;
+        if (lSeconds <= 0) {
+          lSeconds = 1e-6;
+        }
+
+        aOut << (aFirst ? "" : ",") << "\n        {"
+             << "\"name\": \"" << aName << "\", "
+             << "\"iterations\": " << theIterations << ", "
+             << "\"seconds\": " << lSeconds << ", "
+             << "\"mb_per_s\": " << (double)aBytes * theIterations / lSeconds / 1e6 << ", "
+             << "\"nodes_per_s\": " << (double)aNodes * theIterations / lSeconds << ", "
+             << "\"allocations_per_iteration\": " << lAllocations / theIterations << ", "
+             << "\"allocations_per_node\": "
+             << (double)lAllocations / theIterations / (aNodes ? aNodes : 1) << ", "
+             << "\"allocated_bytes_per_iteration\": " << lAllocatedBytes / theIterations
+             << "}";
+      }
+
+      void corpus(ostream& aOut, const Corpus& aCorpus, bool aFirst)
+      {
+        ItemFactory* lFactory = theZorba->getItemFactory();
+        string lHeader =
+          "import module namespace csx = \"http://www.zorba-xquery.com/modules/csx\";\n" +
+          aCorpus.theProlog;
+        string lVocab = aCorpus.theVocab.empty() ? "()" : "\"" + aCorpus.theVocab + "\"";
+
+        // Inputs for the timed queries
+        XQuery_t lLoad = compile(lHeader +
+          "declare variable $xml as xs:string external;\n" + aCorpus.theLoad);
+        lLoad->getDynamicContext()->setVariable("xml", lFactory->createString(aCorpus.theXml));
+        Item lDoc = evaluate(lLoad);
+
+        XQuery_t lCount = compile(
+          "declare variable $doc external;\n"
+          "count($doc/descendant-or-self::node()) + count($doc//@*)");
+        lCount->getDynamicContext()->setVariable("doc", lDoc);
+        uint64_t lNodes = (uint64_t)evaluate(lCount).getLongValue();
+
+        XQuery_t lEncode = compile(lHeader +
+          "declare variable $doc external;\n"
+          "csx:serialize($doc, " + lVocab + ")");
+        lEncode->getDynamicContext()->setVariable("doc", lDoc);
+        Item lCsx = evaluate(lEncode);
+
+        XQuery_t lCsxSize = compile(
+          "declare variable $csx as xs:base64Binary external;\n"
+          "string-length(string($csx)) * 3 idiv 4");
+        lCsxSize->getDynamicContext()->setVariable("csx", lCsx);
+        uint64_t lCsxBytes = (uint64_t)evaluate(lCsxSize).getLongValue();
+
+        XQuery_t lEncodeCompressed = compile(lHeader +
+          "declare variable $doc external;\n"
+          "csx:serialize($doc, " + lVocab + ", <csx:options compressed=\"true\" parallelism=\"0\"/>)");
+        lEncodeCompressed->getDynamicContext()->setVariable("doc", lDoc);
+        Item lCompressed = evaluate(lEncodeCompressed);
+        lCsxSize->getDynamicContext()->setVariable("csx", lCompressed);
+        uint64_t lCompressedBytes = (uint64_t)evaluate(lCsxSize).getLongValue();
+
+        XQuery_t lCsxParseCompressed = compile(lHeader +
+          "declare variable $csx as xs:base64Binary external;\n"
+          "count(csx:parse($csx, " + lVocab + "))");
+        lCsxParseCompressed->getDynamicContext()->setVariable("csx", lCompressed);
+
+        XQuery_t lXmlParse = compile(lHeader +
+          "declare variable $xml as xs:string external;\n" + aCorpus.theLoad);
+        lXmlParse->getDynamicContext()->setVariable("xml", lFactory->createString(aCorpus.theXml));
+
+        XQuery_t lXmlSerialize = compile(
+          "declare variable $doc external;\n"
+          "fn:serialize($doc)");
+        lXmlSerialize->getDynamicContext()->setVariable("doc", lDoc);
+
+        XQuery_t lCsxParse = compile(lHeader +
+          "declare variable $csx as xs:base64Binary external;\n"
+          "count(csx:parse($csx, " + lVocab + "))");
+        lCsxParse->getDynamicContext()->setVariable("csx", lCsx);
+
+        // Straight between XML text and CSX, without building nodes
+        XQuery_t lFromXml = compile(lHeader +
+          "declare variable $bytes as xs:base64Binary external;\n"
+          "csx:from-xml($bytes, " + lVocab + ")");
+        lFromXml->getDynamicContext()->setVariable("bytes", lFactory->createBase64Binary(
+          aCorpus.theXml.data(), aCorpus.theXml.size(), false));
+
+        XQuery_t lToXml = compile(lHeader +
+          "declare variable $csx as xs:base64Binary external;\n"
+          "string-length(csx:to-xml($csx, " + lVocab + "))");
+        lToXml->getDynamicContext()->setVariable("csx", lCsx);
+
+        size_t lBytes = aCorpus.theXml.size();
+        aOut << (aFirst ? "" : ",") << "\n    {"
+             << "\"name\": \"" << aCorpus.theName << "\", "
+             << "\"xml_bytes\": " << lBytes << ", "
+             << "\"csx_bytes\": " << lCsxBytes << ", "
+             << "\"csx_compressed_bytes\": " << lCompressedBytes << ", "
+             << "\"nodes\": " << lNodes << ", "
+             << "\"scenarios\": [";
+        // Throughput is always relative to the size of the XML text
+        scenario(aOut, "xml-parse", lXmlParse, lBytes, lNodes, true);
+        scenario(aOut, "xml-serialize", lXmlSerialize, lBytes, lNodes, false);
+        scenario(aOut, "csx-serialize", lEncode, lBytes, lNodes, false);
+        scenario(aOut, "csx-parse", lCsxParse, lBytes, lNodes, false);
+        scenario(aOut, "csx-serialize-compressed", lEncodeCompressed, lBytes, lNodes, false);
+        scenario(aOut, "csx-parse-compressed", lCsxParseCompressed, lBytes, lNodes, false);
+        scenario(aOut, "csx-from-xml", lFromXml, lBytes, lNodes, false);
+        scenario(aOut, "csx-to-xml", lToXml, lBytes, lNodes, false);
+        parallel(aOut, lHeader, lVocab, lDoc, lCsx, lBytes, lNodes);
+        aOut << "\n      ]}";
+      }
+
+      // The scenarios of the parallel functions, once per thread count
+      void parallel(ostream& aOut, const string& aHeader, const string& aVocab,
+                    const Item& aDoc, const Item& aCsx, size_t aBytes, uint64_t aNodes)
+      {
+        ostringstream lCopies;
+        lCopies << "(for $i in 1 to " << MANY_COPIES << " return ";
+        for (size_t i = 0; i < sizeof(PARALLELISM) / sizeof(PARALLELISM[0]); ++i) {
+          ostringstream lSuffix;
+          lSuffix << "-p" << PARALLELISM[i];
+          ostringstream lParallelism;
+          lParallelism << PARALLELISM[i];
+
+          XQuery_t lSerializeMany = compile(aHeader +
+            "declare variable $doc external;\n"
+            "count(csx:serialize-many(" + lCopies.str() + "$doc), " + aVocab + ", " +
+            lParallelism.str() + "))");
+          lSerializeMany->getDynamicContext()->setVariable("doc", aDoc);
+
+          XQuery_t lParseMany = compile(aHeader +
+            "declare variable $csx as xs:base64Binary external;\n"
+            "count(csx:parse-many(" + lCopies.str() + "$csx), " + aVocab + ", " +
+            lParallelism.str() + "))");
+          lParseMany->getDynamicContext()->setVariable("csx", aCsx);
+
+          // The records of the corpus, one document of the index each
+          XQuery_t lSerializeIndexed = compile(aHeader +
+            "declare variable $doc external;\n"
+            "csx:serialize($doc/*/*, " + aVocab + ", <csx:options indexed=\"true\" "
+            "parallelism=\"" + lParallelism.str() + "\"/>)");
+          lSerializeIndexed->getDynamicContext()->setVariable("doc", aDoc);
+          Item lIndexed = evaluate(lSerializeIndexed);
+
+          XQuery_t lParseIndexed = compile(aHeader +
+            "declare variable $csx as xs:base64Binary external;\n"
+            "count(csx:parse-many($csx, " + aVocab + ", " + lParallelism.str() + "))");
+          lParseIndexed->getDynamicContext()->setVariable("csx", lIndexed);
+
+          scenario(aOut, ("csx-serialize-many" + lSuffix.str()).c_str(), lSerializeMany,
+                   aBytes * MANY_COPIES, aNodes * MANY_COPIES, false);
+          scenario(aOut, ("csx-parse-many" + lSuffix.str()).c_str(), lParseMany,
+                   aBytes * MANY_COPIES, aNodes * MANY_COPIES, false);
+          scenario(aOut, ("csx-serialize-indexed" + lSuffix.str()).c_str(), lSerializeIndexed,
+                   aBytes, aNodes, false);
+          scenario(aOut, ("csx-parse-indexed" + lSuffix.str()).c_str(), lParseIndexed,
+                   aBytes, aNodes, false);
+        }
+      }
+
+    private:
+      Zorba* theZorba;
+      vector<String> thePaths;
+      size_t theIterations;
+  };
+
+}
+
+int main(int argc, char* argv[])
+{
+  vector<String> lPaths;
+  vector<string> lSelected;
+  size_t lSize = 1000;
+  size_t lIterations = 20;
+
+  for (int i = 1; i < argc; ++i) {
+    string lArg = argv[i];
+    if (i + 1 >= argc) {
+      cerr << "missing value for " << lArg << endl;
+      return 2;
+    }
+    string lValue = argv[++i];
+    if (lArg == "--path") {
+      lPaths.push_back(lValue);
+    }
+    else if (lArg == "--size") {
+      lSize = (size_t)atol(lValue.c_str());
+    }
+    else if (lArg == "--iterations") {
+      lIterations = (size_t)atol(lValue.c_str());
+    }
+    else if (lArg == "--corpus") {
+      lSelected.push_back(lValue);
+    }
+    else {
+      cerr << "unknown option " << lArg << endl;
+      return 2;
+    }
+  }
+  if (lIterations == 0) {
+    lIterations = 1;
+  }
+
+  vector<Corpus> lCorpora;
+  makeCorpora(lSize, lCorpora);
+
+  void* lStore = StoreManager::getStore();
+  Zorba* lZorba = Zorba::getInstance(lStore);
+  int lStatus = 0;
+  try {
+    Bench lBench(lZorba, lPaths, lIterations);
+    cout << "{\"size\": " << lSize << ", \"iterations\": " << lIterations
+         << ", \"corpora\": [";
+    bool lFirst = true;
+    for (size_t i = 0; i < lCorpora.size(); ++i) {
+      bool lWanted = lSelected.empty();
+      for (size_t j = 0; j < lSelected.size(); ++j) {
+        lWanted = lWanted || lSelected[j] == lCorpora[i].theName;
+      }
+      if (!lWanted) {
+        continue;
+      }
+      lBench.corpus(cout, lCorpora[i], lFirst);
+      lFirst = false;
+    }
+    cout << "\n  ]}" << endl;
+  }
+  catch (ZorbaException& e) {
+    cerr << e << endl;
+    lStatus = 1;
+  }
+
+  lZorba->shutdown();
+  StoreManager::shutdownStore(lStore);
+  return lStatus;
+}
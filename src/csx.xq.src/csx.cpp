@@ -8,16 +8,24 @@
 #include <zorba/zorba_exception.h>
 #include <zorba/store_consts.h>
 #include <zorba/base64.h>
+#include <zorba/user_exception.h>
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <sstream>
 
 #include "csx.h"
-
-// QQQ
-#include <valgrind/callgrind.h>
+#include "csx_container.h"
+#include "csx_index.h"
+#include "csx_streams.h"
+#include "csx_transcode.h"
+#include "csx_parse_sequence.h"
+#include "csx_plan.h"
+#include "csx_vocab_gen.h"
 
 namespace zorba { namespace csx {
 
@@ -35,11 +43,106 @@ namespace zorba { namespace csx {
         theParseFunction = new ParseFunction(this);
       } 
       return theParseFunction;
+    } else if(localName == "parse-typed"){
+      if(!theParseTypedFunction){
+        theParseTypedFunction = new ParseFunction(this, true);
+      }
+      return theParseTypedFunction;
     } else if(localName == "serialize"){
       if(!theSerializeFunction){
         theSerializeFunction = new SerializeFunction(this);
       }
       return theSerializeFunction;
+    } else if(localName == "load-vocabulary"){
+      if(!theLoadVocabularyFunction){
+        theLoadVocabularyFunction = new LoadVocabularyFunction(this);
+      }
+      return theLoadVocabularyFunction;
+    } else if(localName == "evict-vocabulary"){
+      if(!theEvictVocabularyFunction){
+        theEvictVocabularyFunction = new EvictVocabularyFunction(this);
+      }
+      return theEvictVocabularyFunction;
+    } else if(localName == "processor-pool-stats"){
+      if(!theProcessorPoolStatsFunction){
+        theProcessorPoolStatsFunction = new ProcessorPoolStatsFunction(this);
+      }
+      return theProcessorPoolStatsFunction;
+    } else if(localName == "set-processor-pool-size"){
+      if(!theSetProcessorPoolSizeFunction){
+        theSetProcessorPoolSizeFunction = new SetProcessorPoolSizeFunction(this);
+      }
+      return theSetProcessorPoolSizeFunction;
+    } else if(localName == "set-stream-threshold"){
+      if(!theSetStreamThresholdFunction){
+        theSetStreamThresholdFunction = new SetStreamThresholdFunction(this);
+      }
+      return theSetStreamThresholdFunction;
+    } else if(localName == "serialize-to-file"){
+      if(!theSerializeToFileFunction){
+        theSerializeToFileFunction = new SerializeToFileFunction(this);
+      }
+      return theSerializeToFileFunction;
+    } else if(localName == "serialize-async"){
+      if(!theSerializeAsyncFunction){
+        theSerializeAsyncFunction = new SerializeAsyncFunction(this);
+      }
+      return theSerializeAsyncFunction;
+    } else if(localName == "wait"){
+      if(!theWaitFunction){
+        theWaitFunction = new WaitFunction(this);
+      }
+      return theWaitFunction;
+    } else if(localName == "append"){
+      if(!theAppendFunction){
+        theAppendFunction = new AppendFunction(this);
+      }
+      return theAppendFunction;
+    } else if(localName == "parse-file"){
+      if(!theParseFileFunction){
+        theParseFileFunction = new ParseFileFunction(this);
+      }
+      return theParseFileFunction;
+    } else if(localName == "serialize-many"){
+      if(!theSerializeManyFunction){
+        theSerializeManyFunction = new SerializeManyFunction(this);
+      }
+      return theSerializeManyFunction;
+    } else if(localName == "parse-many"){
+      if(!theParseManyFunction){
+        theParseManyFunction = new ParseManyFunction(this);
+      }
+      return theParseManyFunction;
+    } else if(localName == "stats"){
+      if(!theStatsFunction){
+        theStatsFunction = new StatsFunction(this);
+      }
+      return theStatsFunction;
+    } else if(localName == "reset-stats"){
+      if(!theResetStatsFunction){
+        theResetStatsFunction = new ResetStatsFunction(this);
+      }
+      return theResetStatsFunction;
+    } else if(localName == "count"){
+      if(!theCountFunction){
+        theCountFunction = new CountFunction(this);
+      }
+      return theCountFunction;
+    } else if(localName == "generate-vocabulary"){
+      if(!theGenerateVocabularyFunction){
+        theGenerateVocabularyFunction = new GenerateVocabularyFunction(this);
+      }
+      return theGenerateVocabularyFunction;
+    } else if(localName == "from-xml"){
+      if(!theFromXmlFunction){
+        theFromXmlFunction = new FromXmlFunction(this);
+      }
+      return theFromXmlFunction;
+    } else if(localName == "to-xml"){
+      if(!theToXmlFunction){
+        theToXmlFunction = new ToXmlFunction(this);
+      }
+      return theToXmlFunction;
     }
     return NULL;
   }
@@ -49,25 +152,49 @@ namespace zorba { namespace csx {
     delete this;
   }
 
-  void CSXModule::loadVocab(opencsx::CSXProcessor *aProc, Iterator_t aUriIter) const
+  void CSXModule::raiseError(const char* aCode, const String& aMessage)
+  {
+    Item lError = Zorba::getInstance(0)->getItemFactory()->createQName(
+          CSX_MODULE_NAMESPACE, "csx", aCode);
+    throw USER_EXCEPTION(lError, aMessage);
+  }
+
+  void CSXModule::getVocabs(Iterator_t aUriIter, vector<String>& aUris)
   {
     aUriIter->open();
     Item aUri;
     while (aUriIter->next(aUri)) {
-      void *lStore = zorba::StoreManager::getStore();
-      Zorba* lZorba = Zorba::getInstance(lStore);
-      Item vocab_item = lZorba->getXmlDataManager()->fetch(aUri.getStringValue());
-      aProc->loadVocabulary(vocab_item.getStream());
+      aUris.push_back(aUri.getStringValue());
     }
     aUriIter->close();
   }
 
   CSXModule::~CSXModule()
   {
-    if(!theParseFunction)
-      delete theParseFunction;
-    if(!theSerializeFunction)
-      delete theSerializeFunction;
+    delete theParseFunction;
+    delete theParseTypedFunction;
+    delete theSerializeFunction;
+    delete theLoadVocabularyFunction;
+    delete theEvictVocabularyFunction;
+    delete theProcessorPoolStatsFunction;
+    delete theSetProcessorPoolSizeFunction;
+    delete theSetStreamThresholdFunction;
+    delete theSerializeToFileFunction;
+    delete theSerializeAsyncFunction;
+    delete theWaitFunction;
+    delete theAppendFunction;
+    delete theParseFileFunction;
+    delete theSerializeManyFunction;
+    delete theParseManyFunction;
+    delete theStatsFunction;
+    delete theResetStatsFunction;
+    delete theCountFunction;
+    delete theGenerateVocabularyFunction;
+    delete theFromXmlFunction;
+    delete theToXmlFunction;
+    // Unfinished exports still use the pool
+    delete theExportJobs;
+    delete theProcessorPool;
   }
 
   /*******************************************************************************************
@@ -101,163 +228,567 @@ namespace zorba { namespace csx {
     return sKind;
   }
 
-  void getTypedData(Item item, opencsx::AtomicValue *v){
-    store::SchemaTypeCode iType = item.getTypeCode();
-    //cout << "Item Type: ";
-    switch(iType){
-      case store::XS_BOOLEAN:
-        cout << "boolean";
-        v->m_type = opencsx::DT_BOOLEAN;
-        v->m_value.f_bool = item.getBooleanValue();
-        break;
-      case store::XS_BYTE:
-        cout << "byte";
-        v->m_type = opencsx::DT_BYTE;
-        v->m_value.f_char = (unsigned char)item.getUnsignedIntValue();
-        break;
-      case store::XS_INT:
-        //cout << "integer";
-        v->m_type = opencsx::DT_INT;
-        v->m_value.f_int = item.getIntValue();
-        break;
-      case store::XS_LONG:
-        cout << "long";
-        v->m_type = opencsx::DT_LONG;
-        v->m_value.f_long = item.getLongValue();
-        break;
-      case store::XS_FLOAT:
-        cout << "float";
-        v->m_type = opencsx::DT_FLOAT;
-        v->m_value.f_float = (float)item.getDoubleValue();
-        break;
-      case store::XS_DOUBLE:
-        cout << "double";
-        v->m_type = opencsx::DT_DOUBLE;
-        v->m_value.f_double = item.getDoubleValue();
-        break;
-      case store::XS_STRING:
-      case store::XS_ANY_ATOMIC:
-      default:
-        v->m_type = opencsx::DT_STRING;
-        v->m_string = item.getStringValue().str();
-        break;
+  void Traverser::pushFrame(Iterator_t aChildren, const NameStrings* aName, bool aSkipText,
+                            bool aUntyped)
+  {
+    theStack.push_back(Frame());
+    Frame& lFrame = theStack.back();
+    lFrame.theChildren = aChildren;
+    lFrame.theName = aName;
+    lFrame.theSkipText = aSkipText;
+    lFrame.theUntyped = aUntyped;
+    if (!aChildren.isNull()) {
+      aChildren->open();
+    }
+  }
+
+  const Traverser::NameStrings& Traverser::getNameStrings(const Item& aName)
+  {
+    // Looking up the zorba::Strings only shares them; the std::strings are
+    // made the first time a name is seen
+    NameKey lKey(aName.getNamespace(),
+                 std::make_pair(aName.getLocalName(), aName.getPrefix()));
+    std::map<NameKey, NameStrings>::iterator lIt = theNames.lower_bound(lKey);
+    if (lIt == theNames.end() || theNames.key_comp()(lKey, lIt->first)) {
+      lIt = theNames.insert(lIt, std::make_pair(lKey, NameStrings()));
+      lIt->second.theUri = lKey.first.str();
+      lIt->second.theLocalName = lKey.second.first.str();
+      lIt->second.thePrefix = lKey.second.second.str();
+    }
+    return lIt->second;
+  }
+
+  const opencsx::CSXHandler::NsBindings* Traverser::getBindings(const Item& aElement)
+  {
+    theBindings.clear();
+    aElement.getNamespaceBindings(theBindings,
+                                  zorba::store::StoreConsts::ONLY_LOCAL_NAMESPACES);
+    // Most elements declare nothing, and the rest mostly repeat what a
+    // sibling declared
+    if (theBindings != theLastBindings) {
+      theCsxBindings.resize(theBindings.size());
+      for (size_t i = 0; i < theBindings.size(); ++i) {
+        theCsxBindings[i].first = theBindings[i].first.str();
+        theCsxBindings[i].second = theBindings[i].second.str();
+      }
+      theLastBindings.swap(theBindings);
+    }
+    return &theCsxBindings;
+  }
+
+  const Traverser::NameStrings& Traverser::startElement(Item& aElement, bool aUntyped)
+  {
+    const opencsx::CSXHandler::NsBindings* lBindings = getBindings(aElement);
+    aElement.getNodeName(theName);
+    const NameStrings& lName = getNameStrings(theName);
+    theHandler->startElement(lName.theUri, lName.theLocalName, lName.thePrefix, lBindings);
+    ++theCounters.theElements;
+
+    // go thru attributes
+    Iterator_t attrs = aElement.getAttributes();
+    if (!attrs.isNull()) {
+      attrs->open();
+      while (attrs->next(theAttr)) {
+        theAttr.getNodeName(theName);
+        const NameStrings& lAttrName = getNameStrings(theName);
+        if (aUntyped) {
+          // Attributes of untyped elements are xs:untypedAtomic, which
+          // encodeValue() writes as the string value; no need to atomize
+          String lValue = theAttr.getStringValue();
+          theAtomic.m_type = opencsx::DT_STRING;
+          theAtomic.m_string.assign(lValue.data(), lValue.size());
+        }
+        else {
+          Iterator_t values = theAttr.getAtomizationValue();
+          values->open();
+          // QQQ Since there's no way to pass multiple AtomicValues for an
+          // attribute to OpenCSX, we just get the first.
+          values->next(theValue);
+          encodeValue(theValue, theAtomic);
+          values->close();
+        }
+        theHandler->attribute(lAttrName.theUri, lAttrName.theLocalName,
+                              lAttrName.thePrefix, theAtomic);
+        ++theCounters.theAttributes;
+      }
+      attrs->close();
     }
+    return lName;
   }
 
-  bool traverse(Iterator_t iter, opencsx::CSXHandler* handler, bool skip_text){
-    // given a iterator transverse the item()* tree
-    Item name, item, attr, aName;
-    Iterator_t children, attrs;
-    opencsx::AtomicValue v;
+  bool Traverser::emitTypedValue(Item& aElement)
+  {
+    // We need to use the actual text nodes for unvalidated content (only way
+    // to treat mixed content correctly), but we need to get the typed-value
+    // for validated content. Only getAtomizationValue() gives the typed
+    // value, and it throws for element-only content. Whether it throws
+    // depends on the type, so we remember the answer per type name. Two
+    // types may share a name (anonymous ones in particular), so a type
+    // remembered as atomizable may still throw; then its children are used
+    // and the name is remembered as having element content from then on.
+    // Untyped elements never get here; traverse() emits their text nodes.
+    Item type = aElement.getType();
+    ContentKind& lKind = theContentKinds[std::make_pair(type.getNamespace(),
+                                                        type.getLocalName())];
+    if (lKind == CHILD_CONTENT) {
+      return false;
+    }
+
+    Iterator_t values;
+    try {
+      values = aElement.getAtomizationValue();
+      lKind = ATOMIZED_CONTENT;
+    }
+    catch (ZorbaException&) {
+      lKind = CHILD_CONTENT;
+      return false;
+    }
+
     bool saw_atomics = false;
-    // here comes the magic :)
-    iter->open();
-    while(iter->next(item)){
-      if(item.isNode()){
-        int kind = item.getNodeKind();
-        //cout << "node type: " << getKindAsString(kind) << endl;
-        if(kind == zorba::store::StoreConsts::elementNode){
-          // Map local namespace bindings to CSXHandler form
-          zorba::NsBindings bindings;
-          item.getNamespaceBindings(bindings,
-                                    zorba::store::StoreConsts::ONLY_LOCAL_NAMESPACES);
-          zorba::NsBindings::const_iterator ite = bindings.begin();
-          zorba::NsBindings::const_iterator end = bindings.end();
-          opencsx::CSXHandler::NsBindings csxbindings;
-          for (; ite != end; ++ite) {
-            csxbindings.push_back(std::pair<std::string,std::string>
-                                  (ite->first.str(), ite->second.str()));
-          }
+    values->open();
+    while (values->next(theValue)) {
+      emitAtomic(theValue);
+      saw_atomics = true;
+    }
+    values->close();
+    return saw_atomics;
+  }
 
-          //cout << "<StartElement>" << endl;
-          item.getNodeName(name);
-          string ns, pr, ln;
-          //cout << "name: " << name.getNamespace() << "::" << name.getPrefix() << "::" << name.getLocalName() << endl;
-          ns = name.getNamespace().str();
-          pr = name.getPrefix().str();
-          ln = name.getLocalName().str();
-          //cout << "str name: " << ns << "::" << pr << "::" << ln << endl;
-          handler->startElement(ns, ln, pr, &csxbindings);
-
-          // go thru attributes
-          attrs = item.getAttributes();
-          if(!attrs.isNull()){
-            attrs->open();
-            while(attrs->next(attr)){
-              kind = attr.getNodeKind();
-              //cout << "attr type: " << getKindAsString(kind) << endl;
-              attr.getNodeName(aName);
-              //cout << "attr name: " << aName.getNamespace() << "::" << aName.getPrefix() << "::" << aName.getLocalName() << endl;
-              //cout << "attr text: " << attr.getStringValue() << endl;
-              Iterator_t values = attr.getAtomizationValue();
-              values->open();
-              Item value;
-              // QQQ Since there's no way to pass multiple AtomicValues for an
-              // attribute to OpenCSX, we just get the first.
-              values->next(value);
-              getTypedData(value,&v);
-              handler->attribute(aName.getNamespace().str(), aName.getLocalName().str(),
-                                 aName.getPrefix().str(), v);
-              values->close();
-            }
-          }
+  void Traverser::emitAtomic(const Item& aItem)
+  {
+    encodeValue(aItem, theAtomic);
+    theHandler->atomicValue(theAtomic);
+    ++theCounters.theAtomics;
+  }
+
+  void Traverser::traverse(Iterator_t aItems)
+  {
+    Item item;
+    theStack.clear();
+    pushFrame(aItems, 0, false, false);
+
+    while (!theStack.empty()) {
+      Frame& lTop = theStack.back();
+      if (!lTop.theChildren->next(item)) {
+        lTop.theChildren->close();
+        if (lTop.theName) {
+          theHandler->endElement(lTop.theName->theUri, lTop.theName->theLocalName,
+                                 lTop.theName->thePrefix);
+        }
+        theStack.pop_back();
+        continue;
+      }
+
+      if (!item.isNode()) {
+        emitAtomic(item);
+        continue;
+      }
 
-          bool has_atomic_values = false;
-          // QQQ There should be a better way to do this, but: We need to use the
-          // actual text nodes for unvalidated content (only way to treat mixed
-          // content correctly), but we need to get the typed-value for validated
-          // content.
-          Item type = item.getType();
-          if (type.getLocalName().compare("untyped") != 0) {
-            try {
-              // QQQ Hack necessary at the moment - only way to get typed value is
-              // via getAtomizationValue() (poorly named), but it also throws an
-              // exception if there is element-only content.
-              children = item.getAtomizationValue();
-              has_atomic_values = traverse(children, handler, false);
-            }
-            catch (ZorbaException &e) {
-              //cout << e << endl;
-            }
+      bool lSkipText = lTop.theSkipText;
+      bool lUntyped = lTop.theUntyped;
+      switch (item.getNodeKind()) {
+        case zorba::store::StoreConsts::elementNode: {
+          // Below an xs:untyped element everything is untyped, so only
+          // elements outside one need their type looked at
+          if (!lUntyped) {
+            lUntyped = item.getType().getLocalName().compare("untyped") == 0;
           }
-          children = item.getChildren();
-          if(!children.isNull()){
-            // there is at least one child. We want to skip any text node children
-            // if we've already processing atomic-value children.
-            traverse(children, handler, has_atomic_values);
+          const NameStrings& lName = startElement(item, lUntyped);
+          // We want to skip any text node children if we've already
+          // emitted atomic values for the element.
+          bool has_atomic_values = !lUntyped && emitTypedValue(item);
+          Iterator_t children = item.getChildren();
+          if (children.isNull()) {
+            theHandler->endElement(lName.theUri, lName.theLocalName, lName.thePrefix);
           }
-
-          //cout << "<EndElement>" << endl;
-          handler->endElement(name.getNamespace().str(), name.getLocalName().str(),
-                              name.getPrefix().str());
+          else {
+            pushFrame(children, &lName, has_atomic_values, lUntyped);
+          }
+          break;
         }
-        else if (kind == zorba::store::StoreConsts::textNode) {
-          //cout << "<Characters>" << endl;
-          if (!skip_text) {
-            opencsx::AtomicValue v;
-            v.m_type = opencsx::DT_ANYATOMIC;
-            v.m_string = item.getStringValue().str();
-            handler->atomicValue(v);
+        case zorba::store::StoreConsts::documentNode: {
+          Iterator_t children = item.getChildren();
+          if (!children.isNull()) {
+            pushFrame(children, 0, false, false);
           }
-          children = NULL;
-          //cout << "text content: " << item.getStringValue() << endl;
+          break;
         }
-        else {
-          cout << "Foo: " << getKindAsString(kind);
+        case zorba::store::StoreConsts::textNode:
+          if (!lSkipText) {
+            String lText = item.getStringValue();
+            theAtomic.m_type = opencsx::DT_ANYATOMIC;
+            theAtomic.m_string.assign(lText.data(), lText.size());
+            theHandler->atomicValue(theAtomic);
+            theCounters.theTextBytes += theAtomic.m_string.size();
+          }
+          break;
+        case zorba::store::StoreConsts::commentNode:
+          theHandler->comment(item.getStringValue().str());
+          break;
+        case zorba::store::StoreConsts::piNode:
+          item.getNodeName(theName);
+          theHandler->processingInstruction(theName.getLocalName().str(),
+                                            item.getStringValue().str());
+          break;
+        default:
           assert(false);
+      }
+    }
+  }
+
+  // Writes aItems as one CSX document
+  static void encodeDocument(VocabProcessor& aProcessor, Iterator_t aItems, ostream& aOut)
+  {
+    auto_ptr<opencsx::CSXHandler> csxHandler(aProcessor.get()->createSerializer(aOut));
+
+    // OpenCSX requires a document to create a CSX section header; might be a bug
+    csxHandler->startDocument();
+
+    Traverser lTraverser(csxHandler.get(), aProcessor.getCounters());
+    lTraverser.traverse(aItems);
+
+    csxHandler->endDocument();
+  }
+
+  namespace {
+
+    // Encodes each chunk of items into bytes of its own, with a processor of
+    // its own
+    class ChunkTask : public ParallelTask {
+      public:
+        ChunkTask(ProcessorPool& aPool, const vector<String>& aVocabs,
+                  vector<vector<Item> >& aChunks, vector<vector<char> >& aBuffers)
+          : thePool(aPool), theVocabs(aVocabs), theChunks(aChunks), theBuffers(aBuffers) {}
+
+        virtual void run(size_t aIndex) {
+          PooledProcessor lProcessor(thePool, theVocabs);
+          OutputBuffer lBuffer;
+          ostream lOutputStream(&lBuffer);
+          ItemSequence_t lChunk(new VectorItemSequence(theChunks[aIndex]));
+          encodeDocument(*lProcessor.get(), lChunk->getIterator(), lOutputStream);
+          lOutputStream.flush();
+          lBuffer.release(theBuffers[aIndex]);
         }
+
+      private:
+        ProcessorPool& thePool;
+        const vector<String>& theVocabs;
+        vector<vector<Item> >& theChunks;
+        vector<vector<char> >& theBuffers;
+    };
+
+  }
+
+  // The number of items a top-level item is read back as. The parser
+  // returns elements, comments and processing instructions, those of a
+  // document being its children; atomic values and text at the top level
+  // are not read back.
+  static uint64_t decodedItemCount(const Item& aItem)
+  {
+    if (!aItem.isNode()) {
+      return 0;
+    }
+    switch (aItem.getNodeKind()) {
+      case zorba::store::StoreConsts::elementNode:
+      case zorba::store::StoreConsts::commentNode:
+      case zorba::store::StoreConsts::piNode:
+        return 1;
+      case zorba::store::StoreConsts::documentNode: {
+        uint64_t lCount = 0;
+        Iterator_t lChildren = aItem.getChildren();
+        if (!lChildren.isNull()) {
+          Item lChild;
+          lChildren->open();
+          while (lChildren->next(lChild)) {
+            lCount += decodedItemCount(lChild);
+          }
+          lChildren->close();
+        }
+        return lCount;
       }
-      else {
-        opencsx::AtomicValue v;
-        getTypedData(item, &v);
-        handler->atomicValue(v);
-        saw_atomics = true;
+      default:
+        return 0;
+    }
+  }
+
+  // Writes aItems as segments of aOptions.theChunkSize items each and adds
+  // them to aIndex, with offsets from aBase. The index records how many
+  // items each segment decodes to (see decodedItemCount()). With
+  // parallelism, the segments of a batch are encoded concurrently and then
+  // written in order.
+  static void encodeIndexed(VocabProcessor& aProcessor, ProcessorPool& aPool,
+                            const vector<String>& aVocabs, Iterator_t aItems,
+                            ostream& aOut, const SerializeOptions& aOptions,
+                            SegmentIndex& aIndex, streampos aBase)
+  {
+    size_t lChunkSize = aOptions.theChunkSize > 0 ? aOptions.theChunkSize : 1;
+    unsigned lThreads = aOptions.theParallelism > 0 ?
+      aOptions.theParallelism : hardwareConcurrency();
+    // A few chunks per thread keeps every thread busy while bounding memory
+    size_t lBatch = lThreads > 1 ? lThreads * 4 : 1;
+
+    vector<vector<Item> > lChunks(lBatch);
+    vector<uint64_t> lCounts(lBatch);
+    vector<vector<char> > lBuffers(lThreads > 1 ? lBatch : 0);
+    ChunkTask lTask(aPool, aVocabs, lChunks, lBuffers);
+    Item lItem;
+    bool lMore = true;
+    aItems->open();
+    while (lMore) {
+      size_t lFilled = 0;
+      for (; lFilled < lBatch && lMore; ++lFilled) {
+        vector<Item>& lChunk = lChunks[lFilled];
+        lChunk.clear();
+        lCounts[lFilled] = 0;
+        while (lChunk.size() < lChunkSize && (lMore = aItems->next(lItem))) {
+          lChunk.push_back(lItem);
+          lCounts[lFilled] += decodedItemCount(lItem);
+        }
+        if (lChunk.empty()) {
+          break;
+        }
+      }
+      if (lFilled == 0) {
+        break;
+      }
+
+      if (lThreads <= 1) {
+        aIndex.addSegment(aOut.tellp() - aBase, lCounts[0]);
+        ItemSequence_t lChunk(new VectorItemSequence(lChunks[0]));
+        encodeDocument(aProcessor, lChunk->getIterator(), aOut);
+        continue;
+      }
+
+      string lError = parallelFor(lFilled, lThreads, lTask);
+      if (!lError.empty()) {
+        CSXModule::raiseError("CSX0003", lError);
+      }
+      for (size_t i = 0; i < lFilled; ++i) {
+        aIndex.addSegment(aOut.tellp() - aBase, lCounts[i]);
+        if (!lBuffers[i].empty()) {
+          aOut.write(&lBuffers[i][0], (streamsize)lBuffers[i].size());
+        }
       }
     }
-    // here ends the magic :(
-    iter->close();
+    aItems->close();
+  }
 
-    return saw_atomics;
+  void serializeItems(ProcessorPool& aPool, const vector<String>& aVocabs,
+                      Iterator_t aItems, ostream& aOut, const SerializeOptions& aOptions,
+                      SegmentIndex* aIndex)
+  {
+    PooledProcessor lProcessor(aPool, aVocabs);
+    Counters& lCounters = lProcessor->getCounters();
+    PhaseTimer lTimer(lCounters.theEncodeTime);
+    streampos lBegin = aOut.tellp();
+
+    // A container is cut from the whole stream, which is encoded into
+    // memory first. Appends always add plain segments.
+    bool lCompressed = aOptions.theCompressed && !aIndex;
+    auto_ptr<OutputBuffer> lRaw(lCompressed ? new OutputBuffer() : 0);
+    auto_ptr<ostream> lRawStream(lCompressed ? new ostream(lRaw.get()) : 0);
+    ostream& lOut = lCompressed ? *lRawStream : aOut;
+    streampos lStreamBegin = lOut.tellp();
+
+    if (!aOptions.theIndexed) {
+      encodeDocument(*lProcessor.get(), aItems, lOut);
+    }
+    else {
+      if (lStreamBegin == streampos(-1)) {
+        CSXModule::raiseError("CSX0002", "cannot index a stream without positions");
+      }
+      // A new stream is indexed from where it starts; an appended one
+      // continues the index of the whole file
+      SegmentIndex lNewIndex;
+      SegmentIndex& lIndex = aIndex ? *aIndex : lNewIndex;
+      streampos lBase = aIndex ? streampos(0) : lStreamBegin;
+      uint64_t lVocabulary = lProcessor->getFingerprint(aVocabs);
+      if (lIndex.getVocabulary() != 0 && lIndex.getVocabulary() != lVocabulary) {
+        CSXModule::raiseError("CSX0006", "the stream was written with other vocabularies");
+      }
+      lIndex.setVocabulary(lVocabulary);
+      encodeIndexed(*lProcessor.get(), aPool, aVocabs, aItems, lOut, aOptions,
+                    lIndex, lBase);
+      // The block goes last, so a stream cut short still ends in the
+      // previous one
+      lOut.flush();
+      lIndex.write(lOut, lOut.tellp() - lBase);
+    }
+
+    if (lCompressed) {
+      lOut.flush();
+      BlockContainer::write(lRaw->data(), lRaw->size(), aOut, aOptions.theBlockSize,
+                            aOptions.theParallelism > 0 ?
+                              aOptions.theParallelism : hardwareConcurrency());
+    }
+
+    aOut.flush();
+    streampos lEnd = aOut.tellp();
+    if (lBegin != streampos(-1) && lEnd != streampos(-1)) {
+      lCounters.theOutputBytes += lEnd - lBegin;
+    }
+  }
+
+  void SerializeOptions::read(const Item& aOptions)
+  {
+    if (aOptions.isNull()) {
+      return;
+    }
+    Iterator_t lAttrs = aOptions.getAttributes();
+    lAttrs->open();
+    Item lAttr;
+    Item lName;
+    while (lAttrs->next(lAttr)) {
+      lAttr.getNodeName(lName);
+      String lLocal = lName.getLocalName();
+      String lValue = lAttr.getStringValue();
+      if (lLocal == "indexed") {
+        theIndexed = (lValue == "true" || lValue == "1");
+      }
+      else if (lLocal == "chunk-size") {
+        long lSize = atol(lValue.c_str());
+        theChunkSize = lSize > 0 ? (size_t)lSize : 1;
+      }
+      else if (lLocal == "parallelism") {
+        long lThreads = atol(lValue.c_str());
+        theParallelism = lThreads > 0 ? (unsigned)lThreads : 0;
+      }
+      else if (lLocal == "compressed") {
+        theCompressed = (lValue == "true" || lValue == "1");
+      }
+      else if (lLocal == "block-size") {
+        long lSize = atol(lValue.c_str());
+        theBlockSize = lSize > 0 ? (size_t)lSize : 0;
+      }
+    }
+    lAttrs->close();
+  }
+
+  Item createBinaryItem(OutputBuffer& aBuffer)
+  {
+    // Hand the raw bytes over to the ItemFactory as-is; they are neither
+    // copied nor base64-encoded until somebody asks for the lexical form.
+    BufferInputStream* lResult = new BufferInputStream(aBuffer);
+    return Zorba::getInstance(0)->getItemFactory()->
+      createStreamableBase64Binary(*lResult, &BufferInputStream::release, true, false);
+  }
+
+  namespace {
+
+    // Passes on the items numbered [theFirst, theLast) of those pushed,
+    // counting from the position last set
+    class RangeItemSink : public ItemSink {
+      public:
+        RangeItemSink(ItemSink& aSink)
+          : theSink(aSink), thePosition(0), theFirst(0),
+            theLast(numeric_limits<uint64_t>::max()) {}
+
+        void setRange(uint64_t aFirst, uint64_t aLast) { theFirst = aFirst; theLast = aLast; }
+        void setPosition(uint64_t aPosition) { thePosition = aPosition; }
+
+        virtual void push(const Item& aItem) {
+          if (thePosition >= theFirst && thePosition < theLast) {
+            theSink.push(aItem);
+          }
+          ++thePosition;
+        }
+
+      private:
+        ItemSink& theSink;
+        uint64_t thePosition;
+        uint64_t theFirst;
+        uint64_t theLast;
+    };
+
+  }
+
+  // Hands segment aSegment of an indexed stream to aHandler. Every segment
+  // is a document of its own, so OpenCSX gets exactly its bytes.
+  static void decodeSegment(VocabProcessor& aProcessor, istream& aStream,
+                            const SegmentIndex& aIndex, size_t aSegment,
+                            vector<char>& aScratch, opencsx::CSXHandler& aHandler)
+  {
+    uint64_t lSize = aIndex.end(aSegment) - aIndex.begin(aSegment);
+    aScratch.resize((size_t)lSize + 1);
+    aStream.seekg((streamoff)aIndex.begin(aSegment));
+    if (!aStream.read(&aScratch[0], (streamsize)lSize)) {
+      CSXModule::raiseError("CSX0005", "truncated CSX segment");
+    }
+    MemoryInputBuffer lBuffer(&aScratch[0], (size_t)lSize);
+    istream lSegmentStream(&lBuffer);
+    aProcessor.get()->parse(lSegmentStream, &aHandler);
+    aProcessor.getCounters().theInputBytes += lSize;
+  }
+
+  void parseInto(ProcessorPool& aPool, const vector<String>& aVocabs,
+                 CSXSource& aSource, ItemSink& aSink, const ParseOptions& aOptions)
+  {
+    auto_ptr<Projection> lProjection(
+          aOptions.theProjected ? new Projection(aOptions.theProjection) : 0);
+    PooledProcessor lProcessor(aPool, aVocabs);
+    Counters& lCounters = lProcessor->getCounters();
+    uint64_t lStart = monotonicMicros();
+    RangeItemSink lRange(aSink);
+    CSXParserHandler lHandler(lRange, *lProcessor.get(), lProjection.get(),
+                              aOptions.theTyped, aPool.getStreamThreshold());
+    // Blocks of a container are all decompressed before decoding starts
+    auto_ptr<CSXInput> lInput(openCSX(aSource, hardwareConcurrency()));
+    istream& lStream = lInput->stream();
+    SegmentIndex lIndex;
+    bool lIndexed = lIndex.read(lStream);
+    if (aOptions.theRanged && !lIndexed) {
+      CSXModule::raiseError("CSX0005", "not an indexed CSX stream");
+    }
+
+    lHandler.startDocument();
+    if (!lIndexed) {
+      streampos lBegin = lStream.tellg();
+      lProcessor->get()->parse(lStream, &lHandler);
+
+      // Streams that cannot tell their position are not counted
+      lStream.clear();
+      streampos lEnd = lStream.tellg();
+      if (lBegin != streampos(-1) && lEnd != streampos(-1)) {
+        lCounters.theInputBytes += lEnd - lBegin;
+      }
+    }
+    else {
+      // Items are numbered across segments: skip the segments that lie
+      // outside the range and filter the items of those at its edges
+      uint64_t lFirst = 0;
+      uint64_t lLast = lIndex.totalItems();
+      if (aOptions.theRanged) {
+        lFirst = aOptions.theFirst > 0 ? aOptions.theFirst - 1 : 0;
+        lLast = aOptions.theLast < lLast ? aOptions.theLast : lLast;
+      }
+      lRange.setRange(lFirst, lLast);
+
+      vector<char> lSegment;
+      uint64_t lPosition = 0;
+      for (size_t i = 0; i < lIndex.count() && lPosition < lLast; ++i) {
+        uint64_t lItems = lIndex.items(i);
+        if (lPosition + lItems <= lFirst) {
+          lPosition += lItems;
+          continue;
+        }
+        lRange.setPosition(lPosition);
+        lPosition += lItems;
+        decodeSegment(*lProcessor.get(), lStream, lIndex, i, lSegment, lHandler);
+      }
+    }
+    lHandler.endDocument();
+    // Time blocked on a lazy consumer is not decoding
+    lCounters.theDecodeTime += monotonicMicros() - lStart - lHandler.getSinkTime();
+  }
+
+  static Item getOneItem(const Arguments_t& aArgs, size_t aIndex)
+  {
+    Item lItem;
+    Iterator_t iter = aArgs[aIndex]->getIterator();
+    iter->open();
+    iter->next(lItem);
+    iter->close();
+    return lItem;
   }
 
   zorba::ItemSequence_t
@@ -266,39 +797,24 @@ namespace zorba { namespace csx {
       const zorba::StaticContext* aSctx,
       const zorba::DynamicContext* aDctx) const 
   {
-    //CALLGRIND_START_INSTRUMENTATION;
-
     // Second argument is URIs to vocab files (optional)
-    theModule->loadVocab(theProcessor, aArgs[1]->getIterator());
-
-    // QQQ hack for performance testing - should have an alternate form of
-    // csx:serialize() that takes an output file
-    ofstream theOutputStream("/tmp/out.csx");
-    //stringstream theOutputStream;
-    opencsx::CSXHandler* csxHandler = theProcessor->createSerializer(theOutputStream);
-
-    // OpenCSX requires a document to create a CSX section header; might be a bug
-    csxHandler->startDocument();
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[1]->getIterator(), lVocabs);
 
-    try {
-      // First arg is the item* to serialize
-      traverse(aArgs[0]->getIterator(), csxHandler, false);
-    } catch(ZorbaException ze){
-      cerr << ze << endl;
+    // Third argument, if given, is an options element
+    SerializeOptions lOptions;
+    if (aArgs.size() > 2) {
+      lOptions.read(getOneItem(aArgs, 2));
     }
 
-    csxHandler->endDocument();
+    // Each call encodes into its own buffer, which becomes the result item
+    OutputBuffer lBuffer;
+    ostream lOutputStream(&lBuffer);
+    // First arg is the item* to serialize
+    serializeItems(theModule->getProcessorPool(), lVocabs, aArgs[0]->getIterator(),
+                   lOutputStream, lOptions);
 
-    // QQQ continued hack for performance testing; should introduce an alternate
-    // csx:serializeToFile() or something
-    theOutputStream.close();
-    //CALLGRIND_STOP_INSTRUMENTATION;
-//    string base64Result = zorba::encoding::Base64::encode(theOutputStream.str()).str();
-//    return ItemSequence_t(
-//          new SingletonItemSequence(
-//            Zorba::getInstance(0)->getItemFactory()->
-//            createBase64Binary(base64Result.c_str(),base64Result.length()))
-//          );
+    return ItemSequence_t(new SingletonItemSequence(createBinaryItem(lBuffer)));
   }
 
 
@@ -310,76 +826,846 @@ namespace zorba { namespace csx {
       const zorba::StaticContext* aSctx,
       const zorba::DynamicContext* aDctx) const 
   {
-    //CALLGRIND_START_INSTRUMENTATION;
-
     // Second arg is URIs to vocab files (optional)
-    theModule->loadVocab(theProcessor, aArgs[1]->getIterator());
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[1]->getIterator(), lVocabs);
+
+    // First arg is the base64 item to parse. Nothing is decoded here: the
+    // returned sequence drives the parser as its items are consumed.
+    Iterator_t iter = aArgs[0]->getIterator();
+    iter->open();
+    Item input;
+    bool lHasInput = iter->next(input);
+    iter->close();
+    if (!lHasInput) {
+      return ItemSequence_t(new EmptySequence());
+    }
+    ParseOptions lOptions;
+    lOptions.theTyped = theTyped;
+    if (aArgs.size() > 3) {
+      // Third and fourth args are the range of items
+      int64_t lFirst = getOneItem(aArgs, 2).getLongValue();
+      int64_t lLast = getOneItem(aArgs, 3).getLongValue();
+      lOptions.theRanged = true;
+      lOptions.theFirst = lFirst > 0 ? (uint64_t)lFirst : 0;
+      lOptions.theLast = lLast > 0 ? (uint64_t)lLast : 0;
+    }
+    // Otherwise the third arg, if given, is the projection
+    else if (aArgs.size() > 2) {
+      lOptions.theProjected = true;
+      CSXModule::getVocabs(aArgs[2]->getIterator(), lOptions.theProjection);
+      // Check the paths now rather than on the parser thread
+      Projection lCheck(lOptions.theProjection);
+    }
+    return ItemSequence_t(
+          new ParseSequence(theModule->getProcessorPool(), new ItemSource(input), lVocabs,
+                            lOptions));
+  }
 
-    vector<Item> v;
-    auto_ptr<CSXParserHandler> parserHandler(new CSXParserHandler(v));
+/*******************************************************************************************
+  *******************************************************************************************/
+  // Output buffer when the caller doesn't ask for a size
+  static const size_t DEFAULT_FILE_BUFFER_SIZE = 1024 * 1024;
 
-    try {
-      // First arg is the base64 item to parse
-      Iterator_t iter = aArgs[0]->getIterator();
-      iter->open();
-      Item input;
-      if(iter->next(input)){
-        //string iString = zorba::encoding::Base64::decode(input.getStringValue()).str();
-        //stringstream ss(iString);
-        void *lStore = zorba::StoreManager::getStore();
-        Zorba* lZorba = Zorba::getInstance(lStore);
-        Item input_file = lZorba->getXmlDataManager()->fetch(input.getStringValue());
-        parserHandler->startDocument();
-        theProcessor->parse(input_file.getStream(), parserHandler.get());
-        input.close();
+  void serializeToFile(ProcessorPool& aPool, const vector<String>& aVocabs,
+                       Iterator_t aItems, const String& aPath, size_t aBufferSize)
+  {
+    // The file is written on a thread of its own while the items are
+    // encoded into the other buffer
+    AsyncFileBuffer lBuffer(aBufferSize > 0 ? aBufferSize : DEFAULT_FILE_BUFFER_SIZE);
+    ostream lFile(&lBuffer);
+    Counters lCounters;
+    bool lOpened;
+    {
+      PhaseTimer lTimer(lCounters.theIOTime);
+      lOpened = lBuffer.open(aPath.str());
+    }
+    if (!lOpened) {
+      CSXModule::raiseError("CSX0002", "cannot open " + aPath.str() + " for writing");
+    }
+
+    serializeItems(aPool, aVocabs, aItems, lFile);
+
+    // Only waiting for the last buffer holds up the caller; the writes
+    // before it overlapped with encoding
+    bool lClosed = lBuffer.close();
+    lCounters.theIOTime += lBuffer.getWriteTime();
+    aPool.addCounters(lCounters);
+    if (!lClosed) {
+      CSXModule::raiseError("CSX0002", "cannot write " + aPath.str());
+    }
+  }
+
+  zorba::ItemSequence_t
+    SerializeToFileFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    String lPath = getOneItem(aArgs, 1).getStringValue();
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[2]->getIterator(), lVocabs);
+    size_t lBufferSize = 0;
+    if (aArgs.size() > 3) {
+      int64_t lRequested = getOneItem(aArgs, 3).getLongValue();
+      if (lRequested > 0) {
+        lBufferSize = (size_t)lRequested;
       }
-      iter->close();
     }
-    catch(ZorbaException ze){
-      cerr << ze << endl;
+    serializeToFile(theModule->getProcessorPool(), lVocabs, aArgs[0]->getIterator(), lPath,
+                    lBufferSize);
+    return ItemSequence_t(new EmptySequence());
+  }
+
+  zorba::ItemSequence_t
+    SerializeAsyncFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    String lPath = getOneItem(aArgs, 1).getStringValue();
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[2]->getIterator(), lVocabs);
+    size_t lBufferSize = 0;
+    if (aArgs.size() > 3) {
+      int64_t lRequested = getOneItem(aArgs, 3).getLongValue();
+      if (lRequested > 0) {
+        lBufferSize = (size_t)lRequested;
+      }
+    }
+
+    // The sequence is evaluated here, on the query's thread; the export
+    // only reads the resulting items
+    vector<Item> lItems;
+    Iterator_t lIter = aArgs[0]->getIterator();
+    lIter->open();
+    Item lItem;
+    while (lIter->next(lItem)) {
+      lItems.push_back(lItem);
+    }
+    lIter->close();
+
+    uint64_t lHandle = theModule->getExportJobs().start(lItems, lPath, lVocabs, lBufferSize);
+    return ItemSequence_t(new SingletonItemSequence(
+          Zorba::getInstance(0)->getItemFactory()->createInteger((long long)lHandle)));
+  }
+
+  zorba::ItemSequence_t
+    WaitFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    int64_t lHandle = getOneItem(aArgs, 0).getLongValue();
+    string lError;
+    if (lHandle <= 0 || !theModule->getExportJobs().wait((uint64_t)lHandle, lError)) {
+      CSXModule::raiseError("CSX0008", "no export is running with handle " +
+                            getOneItem(aArgs, 0).getStringValue().str());
+    }
+    if (!lError.empty()) {
+      CSXModule::raiseError("CSX0002", lError);
+    }
+    return ItemSequence_t(new EmptySequence());
+  }
+
+  zorba::ItemSequence_t
+    AppendFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    String lPath = getOneItem(aArgs, 1).getStringValue();
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[2]->getIterator(), lVocabs);
+    SerializeOptions lOptions;
+    if (aArgs.size() > 3) {
+      lOptions.read(getOneItem(aArgs, 3));
     }
+    lOptions.theIndexed = true;
 
-    VectorItemSequence *vSeq = (v.size() > 0)?new VectorItemSequence(v):NULL;
-    parserHandler->endDocument();
-    //CALLGRIND_STOP_INSTRUMENTATION;
-    return ItemSequence_t(vSeq);
+    // Nothing in the file is rewritten: the new segments and their index
+    // block go after whatever the file ends with, even the remains of an
+    // append that did not finish
+    fstream lFile;
+    SegmentIndex lIndex;
+    Counters lCounters;
+    bool lIndexed = true;
+    {
+      PhaseTimer lTimer(lCounters.theIOTime);
+      lFile.open(lPath.c_str(), ios::in | ios::out | ios::binary);
+      if (!lFile) {
+        lFile.clear();
+        lFile.open(lPath.c_str(), ios::out | ios::binary | ios::trunc);
+      }
+      else if (lFile.seekg(0, ios::end) && lFile.tellg() > streampos(0)) {
+        lIndexed = lIndex.recover(lFile);
+      }
+    }
+    if (!lFile) {
+      CSXModule::raiseError("CSX0002", "cannot open " + lPath.str() + " for writing");
+    }
+    if (!lIndexed) {
+      CSXModule::raiseError("CSX0005", lPath.str() + " is not an indexed CSX stream");
+    }
+
+    lFile.seekp(0, ios::end);
+    serializeItems(theModule->getProcessorPool(), lVocabs, aArgs[0]->getIterator(), lFile,
+                   lOptions, &lIndex);
+
+    {
+      PhaseTimer lTimer(lCounters.theIOTime);
+      lFile.close();
+    }
+    theModule->getProcessorPool().addCounters(lCounters);
+    if (lFile.fail()) {
+      CSXModule::raiseError("CSX0002", "cannot write " + lPath.str());
+    }
+    return ItemSequence_t(new EmptySequence());
+  }
+
+  zorba::ItemSequence_t
+    ParseFileFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    String lPath = getOneItem(aArgs, 0).getStringValue();
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[1]->getIterator(), lVocabs);
+
+    // The parser reads straight out of the mapping, which lives as long as
+    // the result sequence
+    Counters lCounters;
+    CSXSource_t lSource;
+    {
+      PhaseTimer lTimer(lCounters.theIOTime);
+      lSource = new MappedFile(lPath);
+    }
+    theModule->getProcessorPool().addCounters(lCounters);
+    return ItemSequence_t(
+          new ParseSequence(theModule->getProcessorPool(), lSource, lVocabs));
+  }
+
+/*******************************************************************************************
+  *******************************************************************************************/
+  static unsigned getParallelism(const Arguments_t& aArgs, size_t aIndex)
+  {
+    int64_t lRequested = getOneItem(aArgs, aIndex).getLongValue();
+    return lRequested > 0 ? (unsigned)lRequested : hardwareConcurrency();
+  }
+
+  namespace {
+
+    class SerializeManyTask : public ParallelTask {
+      public:
+        SerializeManyTask(ProcessorPool& aPool, const vector<String>& aVocabs,
+                          const vector<Item>& aDocs, vector<Item>& aResults)
+          : thePool(aPool), theVocabs(aVocabs), theDocs(aDocs), theResults(aResults) {}
+
+        virtual void run(size_t aIndex) {
+          OutputBuffer lBuffer;
+          ostream lOutputStream(&lBuffer);
+          ItemSequence_t lDoc(new SingletonItemSequence(theDocs[aIndex]));
+          serializeItems(thePool, theVocabs, lDoc->getIterator(), lOutputStream);
+          theResults[aIndex] = createBinaryItem(lBuffer);
+        }
+
+      private:
+        ProcessorPool& thePool;
+        const vector<String>& theVocabs;
+        const vector<Item>& theDocs;
+        vector<Item>& theResults;
+    };
+
+    // A whole input, or the items of one segment of an indexed input
+    struct ParseJob {
+      CSXSource_t theSource;
+      ParseOptions theOptions;
+    };
+
+    class ParseManyTask : public ParallelTask {
+      public:
+        ParseManyTask(ProcessorPool& aPool, const vector<String>& aVocabs,
+                      const vector<ParseJob>& aJobs, vector<vector<Item> >& aResults)
+          : thePool(aPool), theVocabs(aVocabs), theJobs(aJobs), theResults(aResults) {}
+
+        virtual void run(size_t aIndex) {
+          VectorItemSink lSink(theResults[aIndex]);
+          parseInto(thePool, theVocabs, *theJobs[aIndex].theSource, lSink,
+                    theJobs[aIndex].theOptions);
+        }
+
+      private:
+        ProcessorPool& thePool;
+        const vector<String>& theVocabs;
+        const vector<ParseJob>& theJobs;
+        vector<vector<Item> >& theResults;
+    };
+
+  }
+
+  zorba::ItemSequence_t
+    SerializeManyFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    vector<Item> lDocs;
+    Iterator_t iter = aArgs[0]->getIterator();
+    iter->open();
+    Item lDoc;
+    while (iter->next(lDoc)) {
+      lDocs.push_back(lDoc);
+    }
+    iter->close();
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[1]->getIterator(), lVocabs);
+
+    // Every worker checks its own processor out of the pool
+    vector<Item> lResults(lDocs.size());
+    SerializeManyTask lTask(theModule->getProcessorPool(), lVocabs, lDocs, lResults);
+    string lError = parallelFor(lDocs.size(), getParallelism(aArgs, 2), lTask);
+    if (!lError.empty()) {
+      CSXModule::raiseError("CSX0003", lError);
+    }
+    return ItemSequence_t(new VectorItemSequence(lResults));
+  }
+
+  zorba::ItemSequence_t
+    ParseManyFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    vector<Item> lInputs;
+    Iterator_t iter = aArgs[0]->getIterator();
+    iter->open();
+    Item lInput;
+    while (iter->next(lInput)) {
+      lInputs.push_back(lInput);
+    }
+    iter->close();
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[1]->getIterator(), lVocabs);
+
+    unsigned lThreads = getParallelism(aArgs, 2);
+
+    // The segments of an indexed input are decoded independently. Every input
+    // is buffered once so that its jobs can read it concurrently; a
+    // container is decompressed once for all of them.
+    vector<ParseJob> lJobs;
+    for (size_t i = 0; i < lInputs.size(); ++i) {
+      ParseJob lJob;
+      lJob.theSource = new BufferedItemSource(lInputs[i]);
+      SegmentIndex lIndex;
+      {
+        auto_ptr<DecompressedSource> lDecompressed(new DecompressedSource());
+        auto_ptr<CSXInput> lInput(lJob.theSource->open());
+        if (BlockContainer::read(lInput->stream(), lDecompressed->data(), lThreads)) {
+          lInput.reset();
+          lJob.theSource = lDecompressed.release();
+          lInput.reset(lJob.theSource->open());
+        }
+        lIndex.read(lInput->stream());
+      }
+      if (lIndex.count() <= 1) {
+        lJobs.push_back(lJob);
+        continue;
+      }
+      uint64_t lPosition = 0;
+      for (size_t j = 0; j < lIndex.count(); ++j) {
+        lJob.theOptions.theRanged = true;
+        lJob.theOptions.theFirst = lPosition + 1;
+        lPosition += lIndex.items(j);
+        lJob.theOptions.theLast = lPosition;
+        lJobs.push_back(lJob);
+      }
+    }
+
+    vector<vector<Item> > lParsed(lJobs.size());
+    ParseManyTask lTask(theModule->getProcessorPool(), lVocabs, lJobs, lParsed);
+    string lError = parallelFor(lJobs.size(), lThreads, lTask);
+    if (!lError.empty()) {
+      CSXModule::raiseError("CSX0003", lError);
+    }
+
+    // Results in input order
+    vector<Item> lResults;
+    for (size_t i = 0; i < lParsed.size(); ++i) {
+      lResults.insert(lResults.end(), lParsed[i].begin(), lParsed[i].end());
+    }
+    return ItemSequence_t(new VectorItemSequence(lResults));
+  }
+
+/*******************************************************************************************
+  *******************************************************************************************/
+  namespace {
+
+    // Counts the top-level items of a CSX stream without building them
+    class CountingHandler : public opencsx::CSXHandler {
+      public:
+        CountingHandler() : theDepth(0), theCount(0) {}
+
+        uint64_t getCount() const { return theCount; }
+
+        void startDocument() {}
+        void endDocument() { theDepth = 0; }
+        void startElement(const string&, const string&, const string&,
+                          const opencsx::CSXHandler::NsBindings*) {
+          if (theDepth++ == 0) {
+            ++theCount;
+          }
+        }
+        void endElement(const string&, const string&, const string&) { --theDepth; }
+        void attribute(const string&, const string&, const string&,
+                       opencsx::AtomicValue const&) {}
+        void atomicValue(const opencsx::AtomicValue&) {}
+        void processingInstruction(const string&, const string&) { countTopLevel(); }
+        void comment(const string&) { countTopLevel(); }
+
+      private:
+        void countTopLevel() {
+          if (theDepth == 0) {
+            ++theCount;
+          }
+        }
+
+        size_t theDepth;
+        uint64_t theCount;
+    };
+
+  }
+
+  zorba::ItemSequence_t
+    CountFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    Item lInput = getOneItem(aArgs, 0);
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[1]->getIterator(), lVocabs);
+
+    uint64_t lCount = 0;
+    if (!lInput.isNull()) {
+      ItemSource lSource(lInput);
+      auto_ptr<CSXInput> lStream(openCSX(lSource, hardwareConcurrency()));
+      SegmentIndex lIndex;
+      if (lIndex.read(lStream->stream())) {
+        lCount = lIndex.totalItems();
+      }
+      else {
+        // Not indexed: decode, but build nothing
+        PooledProcessor lProcessor(theModule->getProcessorPool(), lVocabs);
+        CountingHandler lHandler;
+        lProcessor->get()->parse(lStream->stream(), &lHandler);
+        lCount = lHandler.getCount();
+      }
+    }
+    return ItemSequence_t(
+          new SingletonItemSequence(
+            Zorba::getInstance(0)->getItemFactory()->createInteger((long long)lCount)));
+  }
+
+/*******************************************************************************************
+  *******************************************************************************************/
+  zorba::ItemSequence_t
+    GenerateVocabularyFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    // The samples go through the same walk as csx:serialize()
+    VocabularyGenerator lGenerator;
+    Counters lCounters;
+    Traverser lTraverser(&lGenerator, lCounters);
+    lTraverser.traverse(aArgs[0]->getIterator());
+
+    // Second arg picks one namespace; otherwise every namespace seen
+    vector<string> lNamespaces;
+    Item lNamespace = getOneItem(aArgs, 1);
+    if (!lNamespace.isNull()) {
+      lNamespaces.push_back(lNamespace.getStringValue().str());
+    }
+    else {
+      lGenerator.getNamespaces(lNamespaces);
+    }
+
+    XmlDataManager* lDataManager = Zorba::getInstance(0)->getXmlDataManager();
+    vector<Item> lSchemas;
+    for (size_t i = 0; i < lNamespaces.size(); ++i) {
+      ostringstream lSchema;
+      lGenerator.writeSchema(lNamespaces[i], lSchema);
+      istringstream lInput(lSchema.str());
+      lSchemas.push_back(lDataManager->parseXML(lInput));
+    }
+    return ItemSequence_t(new VectorItemSequence(lSchemas));
+  }
+
+/*******************************************************************************************
+  *******************************************************************************************/
+  // Whether aXml names the file holding the XML: strings and the types
+  // derived from them, URIs and untyped values do, binaries hold the XML
+  // itself and anything else is a type error
+  static bool isPathItem(const Item& aXml)
+  {
+    if (aXml.isAtomic()) {
+      store::SchemaTypeCode lType = aXml.getTypeCode();
+      if ((lType >= store::XS_STRING && lType <= store::XS_ENTITY)
+          || lType == store::XS_ANY_URI || lType == store::XS_UNTYPED_ATOMIC) {
+        return true;
+      }
+      if (lType == store::XS_BASE64BINARY) {
+        return false;
+      }
+    }
+    Item lError = Zorba::getInstance(0)->getItemFactory()->createQName(
+          "http://www.w3.org/2005/xqt-errors", "err", "XPTY0004");
+    throw USER_EXCEPTION(lError,
+          "csx:from-xml expects xs:base64Binary or the path of a file as a string");
+  }
+
+  zorba::ItemSequence_t
+    FromXmlFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[1]->getIterator(), lVocabs);
+    Item lXml = getOneItem(aArgs, 0);
+
+    // The XML goes straight from the reader into the encoder; no node of
+    // it is ever built
+    OutputBuffer lBuffer;
+    ostream lOutputStream(&lBuffer);
+    {
+      PooledProcessor lProcessor(theModule->getProcessorPool(), lVocabs);
+      Counters& lCounters = lProcessor->getCounters();
+      PhaseTimer lTimer(lCounters.theEncodeTime);
+      auto_ptr<opencsx::CSXHandler> lSerializer(
+            lProcessor->get()->createSerializer(lOutputStream));
+      XmlEventReader lReader(*lSerializer, lCounters);
+      lSerializer->startDocument();
+      if (isPathItem(lXml)) {
+        lReader.readFile(lXml.getStringValue().str());
+      }
+      else {
+        BinaryItemInput lInput(lXml);
+        lReader.readStream(lInput.stream());
+      }
+      lSerializer->endDocument();
+      lOutputStream.flush();
+      lCounters.theOutputBytes += lBuffer.size();
+    }
+    return ItemSequence_t(new SingletonItemSequence(createBinaryItem(lBuffer)));
+  }
+
+  zorba::ItemSequence_t
+    ToXmlFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    vector<String> lVocabs;
+    CSXModule::getVocabs(aArgs[1]->getIterator(), lVocabs);
+    Item lInput = getOneItem(aArgs, 0);
+    if (lInput.isNull()) {
+      return ItemSequence_t(new EmptySequence());
+    }
+
+    OutputBuffer lBuffer;
+    ostream lOutputStream(&lBuffer);
+    {
+      PooledProcessor lProcessor(theModule->getProcessorPool(), lVocabs);
+      Counters& lCounters = lProcessor->getCounters();
+      PhaseTimer lTimer(lCounters.theDecodeTime);
+      XmlWriter lWriter(lOutputStream);
+      ItemSource lSource(lInput);
+      auto_ptr<CSXInput> lItemInput(openCSX(lSource, hardwareConcurrency()));
+      istream& lStream = lItemInput->stream();
+      SegmentIndex lIndex;
+      try {
+        if (!lIndex.read(lStream)) {
+          lProcessor->get()->parse(lStream, &lWriter);
+        }
+        else {
+          vector<char> lSegment;
+          for (size_t i = 0; i < lIndex.count(); ++i) {
+            decodeSegment(*lProcessor.get(), lStream, lIndex, i, lSegment, lWriter);
+          }
+        }
+      }
+      catch (ZorbaException&) {
+        throw;
+      }
+      catch (exception& e) {
+        CSXModule::raiseError("CSX0001", e.what());
+      }
+      lOutputStream.flush();
+    }
+    return ItemSequence_t(new SingletonItemSequence(
+          Zorba::getInstance(0)->getItemFactory()->createString(
+            String(lBuffer.data(), lBuffer.size()))));
+  }
+
+  zorba::ItemSequence_t
+    LoadVocabularyFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    Iterator_t iter = aArgs[0]->getIterator();
+    iter->open();
+    Item lUri;
+    iter->next(lUri);
+    iter->close();
+
+    uint64_t lHash = VocabularyCache::instance().reload(lUri.getStringValue());
+    return ItemSequence_t(
+          new SingletonItemSequence(
+            Zorba::getInstance(0)->getItemFactory()->
+            createString(VocabularyCache::hashToString(lHash))));
+  }
+
+  zorba::ItemSequence_t
+    EvictVocabularyFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    Iterator_t iter = aArgs[0]->getIterator();
+    iter->open();
+    Item lUri;
+    iter->next(lUri);
+    iter->close();
+
+    bool lEvicted = VocabularyCache::instance().evict(lUri.getStringValue());
+    return ItemSequence_t(
+          new SingletonItemSequence(
+            Zorba::getInstance(0)->getItemFactory()->createBoolean(lEvicted)));
+  }
+
+  static void addStatAttribute(ItemFactory* aFactory, Item& aElement,
+                               const char* aName, uint64_t aValue)
+  {
+    ostringstream lValue;
+    lValue << aValue;
+    aFactory->createAttributeNode(
+          aElement, aFactory->createQName("", "", aName),
+          aFactory->createQName("http://www.w3.org/2001/XMLSchema", "untypedAtomic"),
+          aFactory->createUntypedAtomic(lValue.str()));
+  }
+
+  zorba::ItemSequence_t
+    ProcessorPoolStatsFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    ItemFactory* lFactory = Zorba::getInstance(0)->getItemFactory();
+    ProcessorPool::Stats lStats = theModule->getProcessorPool().getStats();
+
+    zorba::NsBindings lBindings;
+    lBindings.push_back(pair<zorba::String,zorba::String>("csx", theModule->getURI()));
+    Item lParent;
+    Item lElement = lFactory->createElementNode(
+          lParent, lFactory->createQName(theModule->getURI(), "csx", "processor-pool"),
+          lFactory->createQName("http://www.w3.org/2001/XMLSchema", "untyped"),
+          false, false, lBindings);
+    addStatAttribute(lFactory, lElement, "max-idle", lStats.theMaxIdle);
+    addStatAttribute(lFactory, lElement, "idle", lStats.theIdle);
+    addStatAttribute(lFactory, lElement, "live", lStats.theLive);
+    addStatAttribute(lFactory, lElement, "hits", lStats.theHits);
+    addStatAttribute(lFactory, lElement, "misses", lStats.theMisses);
+    addStatAttribute(lFactory, lElement, "created", lStats.theCreated);
+    addStatAttribute(lFactory, lElement, "discarded", lStats.theDiscarded);
+    return ItemSequence_t(new SingletonItemSequence(lElement));
+  }
+
+  zorba::ItemSequence_t
+    StatsFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    ItemFactory* lFactory = Zorba::getInstance(0)->getItemFactory();
+    Counters lCounters = theModule->getProcessorPool().getCounters();
+
+    zorba::NsBindings lBindings;
+    lBindings.push_back(pair<zorba::String,zorba::String>("csx", theModule->getURI()));
+    Item lParent;
+    Item lElement = lFactory->createElementNode(
+          lParent, lFactory->createQName(theModule->getURI(), "csx", "stats"),
+          lFactory->createQName("http://www.w3.org/2001/XMLSchema", "untyped"),
+          false, false, lBindings);
+    addStatAttribute(lFactory, lElement, "elements", lCounters.theElements);
+    addStatAttribute(lFactory, lElement, "attributes", lCounters.theAttributes);
+    addStatAttribute(lFactory, lElement, "atomics", lCounters.theAtomics);
+    addStatAttribute(lFactory, lElement, "text-bytes", lCounters.theTextBytes);
+    addStatAttribute(lFactory, lElement, "input-bytes", lCounters.theInputBytes);
+    addStatAttribute(lFactory, lElement, "output-bytes", lCounters.theOutputBytes);
+    addStatAttribute(lFactory, lElement, "vocabulary-loads", lCounters.theVocabularyLoads);
+    addStatAttribute(lFactory, lElement, "spilled-bytes", lCounters.theSpilledBytes);
+    addStatAttribute(lFactory, lElement, "name-hits", lCounters.theNameHits);
+    addStatAttribute(lFactory, lElement, "name-misses", lCounters.theNameMisses);
+    addStatAttribute(lFactory, lElement, "vocabulary-time", lCounters.theVocabularyTime);
+    addStatAttribute(lFactory, lElement, "encode-time", lCounters.theEncodeTime);
+    addStatAttribute(lFactory, lElement, "decode-time", lCounters.theDecodeTime);
+    addStatAttribute(lFactory, lElement, "io-time", lCounters.theIOTime);
+    return ItemSequence_t(new SingletonItemSequence(lElement));
+  }
+
+  zorba::ItemSequence_t
+    ResetStatsFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    theModule->getProcessorPool().resetCounters();
+    return ItemSequence_t(new EmptySequence());
+  }
+
+  zorba::ItemSequence_t
+    SetProcessorPoolSizeFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    Iterator_t iter = aArgs[0]->getIterator();
+    iter->open();
+    Item lSize;
+    iter->next(lSize);
+    iter->close();
+
+    int64_t lMaxIdle = lSize.getLongValue();
+    size_t lPrevious = theModule->getProcessorPool().setMaxIdle(
+          lMaxIdle > 0 ? (size_t)lMaxIdle : 0);
+    return ItemSequence_t(
+          new SingletonItemSequence(
+            Zorba::getInstance(0)->getItemFactory()->createInteger((long long)lPrevious)));
+  }
+
+  zorba::ItemSequence_t
+    SetStreamThresholdFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const
+  {
+    int64_t lBytes = getOneItem(aArgs, 0).getLongValue();
+    size_t lPrevious = theModule->getProcessorPool().setStreamThreshold(
+          lBytes > 0 ? (size_t)lBytes : 0);
+    return ItemSequence_t(
+          new SingletonItemSequence(
+            Zorba::getInstance(0)->getItemFactory()->createInteger((long long)lPrevious)));
   }
 
   /*** Start the CSXParserHandler implementation ***/
 
-  CSXParserHandler::CSXParserHandler(vector<Item>& aItems)
-    : m_result(aItems) {
+  CSXParserHandler::CSXParserHandler(ItemSink& aSink, VocabProcessor& aProcessor,
+                                     Projection* aProjection, bool aTyped,
+                                     size_t aStreamThreshold)
+    : m_names(aProcessor.getNameCache()), m_scratch(aProcessor.getParseScratch()),
+      m_plan(DecodePlan::get()),
+      m_counters(aProcessor.getCounters()), m_sinkTime(0),
+      m_elemStack(m_scratch.theElements), m_sink(aSink), m_atomics(m_scratch.theAtomics),
+      m_defaultType(m_scratch.theUntypedType),
+      m_defaultAttrType(m_scratch.theAnyAtomicType), m_projection(aProjection),
+      m_skipDepth(0), m_keepDepth(0), m_pending(m_scratch.thePending), m_pendingCount(0),
+      m_typed(aTyped), m_deferred(false), m_deferredBindings(0), m_afterString(false),
+      m_deferredAttrs(m_scratch.theDeferredAttrs),
+      m_anyType(m_scratch.theAnyType), m_streamThreshold(aStreamThreshold) {
     m_itemFactory = Zorba::getInstance(NULL)->getItemFactory();
-    m_defaultType = m_itemFactory->createQName(
-          zorba::String("http://www.w3.org/2001/XMLSchema"),
-          zorba::String("untyped"));
-    m_defaultAttrType = m_itemFactory->createQName(
-          zorba::String("http://www.w3.org/2001/XMLSchema"),
-          zorba::String("AnyAtomicType"));
+    // A parse that failed half-way may have left nodes behind
+    m_scratch.clear();
   }
 
   void CSXParserHandler::startDocument(){
   }
 
   void CSXParserHandler::endDocument(){
-    m_elemStack.clear();
+    m_scratch.clear();
+    m_deferred = false;
+    m_skipDepth = 0;
+    m_keepDepth = 0;
+    m_pendingCount = 0;
   }
 
   void CSXParserHandler::startElement(const string& uri, const string& localname,
                                       const string& prefix,
                                       const opencsx::CSXHandler::NsBindings *bindings){
-    zorba::String zUri = zorba::String(uri);
-    zorba::String zLocalName = zorba::String(localname);
-    zorba::String zPrefix = zorba::String(prefix);
-    //cout << "nodename composites: zUri: " << zUri << " zPrefix: " << zPrefix << " zLocalName: " << zLocalName << endl;
-    Item nodeName = m_itemFactory->createQName(zUri, zPrefix, zLocalName);
+    ++m_counters.theElements;
+    if (!m_projection) {
+      buildElement(uri, localname, prefix, bindings);
+      return;
+    }
+    // Skipped subtrees cost no strings, QNames or nodes
+    if (m_skipDepth > 0) {
+      ++m_skipDepth;
+      return;
+    }
+    if (m_keepDepth > 0) {
+      ++m_keepDepth;
+      buildElement(uri, localname, prefix, bindings);
+      return;
+    }
+    switch (m_projection->enter(uri, localname)) {
+      case Projection::SKIP:
+        m_skipDepth = 1;
+        break;
+      case Projection::KEEP:
+        buildPending();
+        m_keepDepth = 1;
+        buildElement(uri, localname, prefix, bindings);
+        break;
+      case Projection::ANCESTOR: {
+        if (m_pending.size() <= m_pendingCount) {
+          m_pending.resize(m_pendingCount + 1);
+        }
+        PendingElement& lPending = m_pending[m_pendingCount++];
+        lPending.theUri = uri;
+        lPending.theLocalName = localname;
+        lPending.thePrefix = prefix;
+        if (bindings) {
+          lPending.theBindings = *bindings;
+        } else {
+          lPending.theBindings.clear();
+        }
+        lPending.theBuilt = false;
+        break;
+      }
+    }
+  }
+
+  void CSXParserHandler::buildPending(){
+    for (size_t i = 0; i < m_pendingCount; ++i) {
+      PendingElement& lPending = m_pending[i];
+      if (!lPending.theBuilt) {
+        buildElement(lPending.theUri, lPending.theLocalName, lPending.thePrefix,
+                     &lPending.theBindings);
+        lPending.theBuilt = true;
+      }
+    }
+  }
+
+  void CSXParserHandler::buildElement(const string& uri, const string& localname,
+                                      const string& prefix,
+                                      const opencsx::CSXHandler::NsBindings *bindings){
+    // A parent with element children has complex content. It is created
+    // before getBindings() can invalidate its m_deferredBindings.
+    if (m_deferred) {
+      createDeferred(m_anyType);
+    }
+    m_afterString = false;
 
-    opencsx::CSXHandler::NsBindings::const_iterator ite = bindings->begin();
-    opencsx::CSXHandler::NsBindings::const_iterator end = bindings->end();
-    zorba::NsBindings itembindings;
-    for (; ite != end; ++ite) {
-      itembindings.push_back(pair<zorba::String,zorba::String>
-                             (zorba::String(ite->first), zorba::String(ite->second)));
+    const Item& nodeName = m_names.getQName(uri, prefix, localname);
+    const zorba::NsBindings& itembindings = m_names.getBindings(bindings);
+
+    if (m_typed) {
+      m_deferred = true;
+      m_deferredName = nodeName;
+      m_deferredBindings = &itembindings;
+      return;
     }
 
     Item parent = m_elemStack.empty() ? Item() : m_elemStack.back();
@@ -390,7 +1676,53 @@ namespace zorba { namespace csx {
     m_elemStack.push_back(thisNode);
   }
 
+  void CSXParserHandler::createDeferred(const Item& aType){
+    Item parent = m_elemStack.empty() ? Item() : m_elemStack.back();
+    Item thisNode = m_itemFactory->createElementNode(parent, m_deferredName,
+                                                     aType, true, false,
+                                                     *m_deferredBindings);
+    for (size_t i = 0; i < m_deferredAttrs.size(); ++i) {
+      ParseScratch::DeferredAttribute& lAttr = m_deferredAttrs[i];
+      m_itemFactory->createAttributeNode(thisNode, lAttr.theName, lAttr.theType,
+                                         lAttr.theValue);
+    }
+    m_deferredAttrs.clear();
+    m_deferredName = Item();
+    m_deferred = false;
+    m_elemStack.push_back(thisNode);
+  }
+
   void CSXParserHandler::endElement(const string &uri, const string &localname, const string &prefix){
+    if (m_projection) {
+      if (m_skipDepth > 0) {
+        --m_skipDepth;
+        return;
+      }
+      if (m_keepDepth > 0) {
+        --m_keepDepth;
+      }
+      else {
+        // Closing an ancestor; it only exists if something below was kept
+        m_projection->leave();
+        if (!m_pending[--m_pendingCount].theBuilt) {
+          return;
+        }
+      }
+    }
+    finishElement();
+  }
+
+  void CSXParserHandler::emit(const Item& aItem){
+    uint64_t lStart = monotonicMicros();
+    m_sink.push(aItem);
+    m_sinkTime += monotonicMicros() - lStart;
+  }
+
+  void CSXParserHandler::finishElement(){
+    if (m_deferred) {
+      createDeferred(m_anyType);
+    }
+    m_afterString = false;
     // If there are cached atomics, assign them as the typed-value of the
     // current element.
     Item lItem = m_elemStack.back();
@@ -399,18 +1731,39 @@ namespace zorba { namespace csx {
       m_atomics.clear();
     }
 
-    // Pop current element off stack; if it's unparented, add it to the output vector
+    // Pop current element off stack; if it's unparented, hand it to the sink
     // QQQ We don't currently handle anything other than elements as results
     m_elemStack.pop_back();
-    if (lItem.getParent().isNull()) {
-      m_result.push_back(lItem);
+    if (m_elemStack.empty()) {
+      emit(lItem);
     }
   }
 
   void CSXParserHandler::atomicValue(const opencsx::AtomicValue &value) {
-    // AnyAtomic strings are text nodes in Zorba.
     if (value.m_type == opencsx::DT_ANYATOMIC) {
-      m_itemFactory->createTextNode(m_elemStack.back(), value.m_string);
+      m_counters.theTextBytes += value.m_string.size();
+    }
+    else {
+      ++m_counters.theAtomics;
+    }
+    // Values outside any element, written for top-level atomics and text,
+    // are not items of the result
+    if (isProjectedOut() || (!m_deferred && m_elemStack.empty())) {
+      return;
+    }
+    // AnyAtomic strings are text nodes in Zorba. So are strings in typed
+    // mode, since the stream does not say which type they had.
+    bool lText = value.m_type == opencsx::DT_ANYATOMIC ||
+                 (m_typed && value.m_type == opencsx::DT_STRING);
+    if (m_deferred) {
+      createDeferred(lText ? m_anyType : m_plan.getKind(value.m_type).theType);
+    }
+    if (lText) {
+      // Items of a list of strings stay apart
+      bool lListItem = m_afterString && value.m_type == opencsx::DT_STRING;
+      m_itemFactory->createTextNode(m_elemStack.back(), lListItem ?
+                                    " " + value.m_string : value.m_string);
+      m_afterString = value.m_type == opencsx::DT_STRING;
     }
     else {
       // Cache atomics in case the element has a list of them, because we can
@@ -421,58 +1774,83 @@ namespace zorba { namespace csx {
 
   void CSXParserHandler::attribute(const string &uri, const string &localname,
                                    const string &prefix, const opencsx::AtomicValue &value) {
-    zorba::String zAttrName = zorba::String(localname);
-    zorba::String zUri = zorba::String(uri);
-    zorba::String zPrefix = zorba::String(prefix);
-    Item nodeName = m_itemFactory->createQName(zUri, zPrefix, zAttrName);
+    ++m_counters.theAttributes;
+    if (isProjectedOut()) {
+      return;
+    }
+    const Item& nodeName = m_names.getQName(uri, prefix, localname);
+    if (m_typed) {
+      // The plan gives DT_ANYATOMIC and DT_STRING values xs:untypedAtomic
+      m_deferredAttrs.push_back(ParseScratch::DeferredAttribute());
+      ParseScratch::DeferredAttribute& lAttr = m_deferredAttrs.back();
+      lAttr.theName = nodeName;
+      lAttr.theValue = getAtomicItem(value);
+      lAttr.theType = m_plan.getKind(value.m_type).theType;
+      return;
+    }
     // QQQ handle other simple types!
-    Item attrNodeValue = m_itemFactory->createString(zorba::String(value.m_string));
+    Item attrNodeValue = getStringItem(value.m_string);
     m_itemFactory->createAttributeNode(
           m_elemStack.back(), nodeName, m_defaultAttrType, attrNodeValue);
   }
 
   void CSXParserHandler::processingInstruction(const string &target, const string &data){
-    cout << "inside processinginstruction(" << target << ", " << data << ")" << endl;
-    // No need to implement yet
+    if (isProjectedOut()) {
+      return;
+    }
+    if (m_deferred) {
+      createDeferred(m_anyType);
+    }
+    Item parent = m_elemStack.empty() ? Item() : m_elemStack.back();
+    zorba::String zTarget(target);
+    zorba::String zData(data);
+    zorba::String zBaseUri;
+    Item lPi = m_itemFactory->createPiNode(parent, zTarget, zData, zBaseUri);
+    if (parent.isNull()) {
+      emit(lPi);
+    }
   }
 
   void CSXParserHandler::comment(const string &chars){
-    cout << "inside comment(" << chars << ")" << endl;
-    // No need to implement yet
+    if (isProjectedOut()) {
+      return;
+    }
+    if (m_deferred) {
+      createDeferred(m_anyType);
+    }
+    Item parent = m_elemStack.empty() ? Item() : m_elemStack.back();
+    zorba::String zChars(chars);
+    Item lComment = m_itemFactory->createCommentNode(parent, zChars);
+    if (parent.isNull()) {
+      emit(lComment);
+    }
   }
 
   CSXParserHandler::~CSXParserHandler(){
-    m_elemStack.clear();
+    m_scratch.clear();
   }
 
   Item
   CSXParserHandler::getAtomicItem(opencsx::AtomicValue const& v){
-    //cout << "Item Type: ";
-    switch(v.m_type){
-      case opencsx::DT_BOOLEAN:
-        cout << "boolean";
-        return m_itemFactory->createBoolean(v.m_value.f_bool);
-      case opencsx::DT_BYTE:
-        cout << "byte";
-        return m_itemFactory->createByte(v.m_value.f_char);
-      case opencsx::DT_INT:
-        //cout << "integer";
-        return m_itemFactory->createInt(v.m_value.f_int);
-        break;
-      case opencsx::DT_LONG:
-        cout << "long";
-        return m_itemFactory->createLong(v.m_value.f_long);
-      case opencsx::DT_FLOAT:
-        cout << "float";
-        return m_itemFactory->createFloat(v.m_value.f_float);
-      case opencsx::DT_DOUBLE:
-        cout << "double";
-        return m_itemFactory->createDouble(v.m_value.f_double);
-      case opencsx::DT_STRING:
-        return m_itemFactory->createString(v.m_string);
-      default:
-        assert(false);
+    // Untyped strings may be spilled to a file
+    if (!m_typed && v.m_type == opencsx::DT_STRING) {
+      return getStringItem(v.m_string);
+    }
+    return m_plan.getKind(v.m_type).theCreate(m_itemFactory, v);
+  }
+
+  Item
+  CSXParserHandler::getStringItem(const string& aValue){
+    if (m_streamThreshold > 0 && aValue.size() >= m_streamThreshold) {
+      // Only the file is kept; if there is none, keep the value after all
+      SpillFileStream* lStream = SpillFileStream::create(aValue);
+      if (lStream) {
+        m_counters.theSpilledBytes += aValue.size();
+        return m_itemFactory->createStreamableString(*lStream, &SpillFileStream::release,
+                                                     true);
+      }
     }
+    return m_itemFactory->createString(aValue);
   }
 
 
@@ -8,21 +8,64 @@
 #include <opencsx/csxhandler.h>
 #include <opencsx/csxprocessor.h>
 #include <opencsx/stdvocab.h>
+#include <map>
 #include <vector>
 
+#include "csx_async.h"
+#include "csx_plan.h"
+#include "csx_pool.h"
+#include "csx_projection.h"
+#include "csx_stats.h"
+#include "csx_streams.h"
+
 namespace zorba { namespace csx {
 
+  class SegmentIndex;
+
   class CSXModule : public ExternalModule {
 		private:
 
       const static String CSX_MODULE_NAMESPACE;
 
       ExternalFunction* theParseFunction;
+      ExternalFunction* theParseTypedFunction;
       ExternalFunction* theSerializeFunction;
+      ExternalFunction* theLoadVocabularyFunction;
+      ExternalFunction* theEvictVocabularyFunction;
+      ExternalFunction* theProcessorPoolStatsFunction;
+      ExternalFunction* theSetProcessorPoolSizeFunction;
+      ExternalFunction* theSetStreamThresholdFunction;
+      ExternalFunction* theSerializeToFileFunction;
+      ExternalFunction* theSerializeAsyncFunction;
+      ExternalFunction* theWaitFunction;
+      ExternalFunction* theAppendFunction;
+      ExternalFunction* theParseFileFunction;
+      ExternalFunction* theSerializeManyFunction;
+      ExternalFunction* theParseManyFunction;
+      ExternalFunction* theStatsFunction;
+      ExternalFunction* theResetStatsFunction;
+      ExternalFunction* theCountFunction;
+      ExternalFunction* theGenerateVocabularyFunction;
+      ExternalFunction* theFromXmlFunction;
+      ExternalFunction* theToXmlFunction;
+
+      ProcessorPool* theProcessorPool;
+      ExportJobs* theExportJobs;
 
     public:
 
-      inline CSXModule():theParseFunction(0), theSerializeFunction(0){}
+      inline CSXModule():theParseFunction(0), theParseTypedFunction(0),
+        theSerializeFunction(0),
+        theLoadVocabularyFunction(0), theEvictVocabularyFunction(0),
+        theProcessorPoolStatsFunction(0), theSetProcessorPoolSizeFunction(0),
+        theSetStreamThresholdFunction(0),
+        theSerializeToFileFunction(0), theSerializeAsyncFunction(0), theWaitFunction(0),
+        theAppendFunction(0), theParseFileFunction(0),
+        theSerializeManyFunction(0), theParseManyFunction(0),
+        theStatsFunction(0), theResetStatsFunction(0), theCountFunction(0),
+        theGenerateVocabularyFunction(0), theFromXmlFunction(0), theToXmlFunction(0),
+        theProcessorPool(new ProcessorPool(hardwareConcurrency())),
+        theExportJobs(new ExportJobs(*theProcessorPool)){}
 
       virtual ~CSXModule();
 
@@ -34,21 +77,24 @@ namespace zorba { namespace csx {
 
       virtual void destroy();
 
-      void loadVocab(opencsx::CSXProcessor* aProc, Iterator_t aUriIter) const;
+      // Throws csx:<aCode> with the given description
+      static void raiseError(const char* aCode, const String& aMessage);
+
+      ProcessorPool& getProcessorPool() const { return *theProcessorPool; }
+
+      ExportJobs& getExportJobs() const { return *theExportJobs; }
+
+      static void getVocabs(Iterator_t aUriIter, std::vector<String>& aUris);
   };
 
+  // Serves both csx:parse() and csx:parse-typed()
   class ParseFunction : public ContextualExternalFunction{
     public:
-      ParseFunction(const CSXModule* aModule) : theModule(aModule) {
-        theProcessor = opencsx::CSXProcessor::create();
-      }
-
-      virtual ~ParseFunction() {
-        delete theProcessor;
-      }
+      ParseFunction(const CSXModule* aModule, bool aTyped = false)
+        : theModule(aModule), theTyped(aTyped) {}
 
       virtual zorba::String
-        getLocalName() const { return "parse"; }
+        getLocalName() const { return theTyped ? "parse-typed" : "parse"; }
 
       virtual zorba::ItemSequence_t
         evaluate(const Arguments_t&,
@@ -61,22 +107,315 @@ namespace zorba { namespace csx {
 
     protected:
       const CSXModule *theModule;
-    private:
-      opencsx::CSXProcessor* theProcessor;
+      bool theTyped;
   };
 
   class SerializeFunction : public ContextualExternalFunction{
     public:
-      SerializeFunction(const CSXModule* aModule) : theModule(aModule) {
-        theProcessor = opencsx::CSXProcessor::create();
+      SerializeFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "serialize"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
       }
 
-      virtual ~SerializeFunction(){
-        delete theProcessor;
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class SerializeToFileFunction : public ContextualExternalFunction{
+    public:
+      SerializeToFileFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "serialize-to-file"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
       }
 
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class SerializeAsyncFunction : public ContextualExternalFunction{
+    public:
+      SerializeAsyncFunction(const CSXModule* aModule) : theModule(aModule) {}
+
       virtual zorba::String
-      getLocalName() const { return "serialize"; }
+      getLocalName() const { return "serialize-async"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class WaitFunction : public ContextualExternalFunction{
+    public:
+      WaitFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "wait"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class AppendFunction : public ContextualExternalFunction{
+    public:
+      AppendFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "append"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class ParseFileFunction : public ContextualExternalFunction{
+    public:
+      ParseFileFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "parse-file"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class SerializeManyFunction : public ContextualExternalFunction{
+    public:
+      SerializeManyFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "serialize-many"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class ParseManyFunction : public ContextualExternalFunction{
+    public:
+      ParseManyFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "parse-many"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class CountFunction : public ContextualExternalFunction{
+    public:
+      CountFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "count"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class GenerateVocabularyFunction : public ContextualExternalFunction{
+    public:
+      GenerateVocabularyFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "generate-vocabulary"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class FromXmlFunction : public ContextualExternalFunction{
+    public:
+      FromXmlFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "from-xml"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class ToXmlFunction : public ContextualExternalFunction{
+    public:
+      ToXmlFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "to-xml"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class LoadVocabularyFunction : public ContextualExternalFunction{
+    public:
+      LoadVocabularyFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "load-vocabulary"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class EvictVocabularyFunction : public ContextualExternalFunction{
+    public:
+      EvictVocabularyFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "evict-vocabulary"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class ProcessorPoolStatsFunction : public ContextualExternalFunction{
+    public:
+      ProcessorPoolStatsFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "processor-pool-stats"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class SetProcessorPoolSizeFunction : public ContextualExternalFunction{
+    public:
+      SetProcessorPoolSizeFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "set-processor-pool-size"; }
 
       virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -89,8 +428,196 @@ namespace zorba { namespace csx {
 
     protected:
       const CSXModule* theModule;
+  };
+
+  class SetStreamThresholdFunction : public ContextualExternalFunction{
+    public:
+      SetStreamThresholdFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "set-stream-threshold"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class StatsFunction : public ContextualExternalFunction{
+    public:
+      StatsFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "stats"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  class ResetStatsFunction : public ContextualExternalFunction{
+    public:
+      ResetStatsFunction(const CSXModule* aModule) : theModule(aModule) {}
+
+      virtual zorba::String
+      getLocalName() const { return "reset-stats"; }
+
+      virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+
+      virtual String getURI() const {
+        return theModule->getURI();
+      }
+
+    protected:
+      const CSXModule* theModule;
+  };
+
+  /**
+   * How csx:serialize() writes its result.
+   */
+  struct SerializeOptions {
+    SerializeOptions()
+      : theIndexed(false), theChunkSize(1), theParallelism(1), theCompressed(false),
+        theBlockSize(0) {}
+
+    // Read from an <csx:options/> element; unknown attributes are ignored
+    void read(const Item& aOptions);
+
+    // Segments of theChunkSize top-level items plus a SegmentIndex trailer
+    bool theIndexed;
+    size_t theChunkSize;
+
+    // Threads encoding segments or compressing blocks at a time; 0 for one
+    // per hardware thread
+    unsigned theParallelism;
+
+    // Wrap the stream into a BlockContainer of blocks of theBlockSize
+    // bytes (0 for the default)
+    bool theCompressed;
+    size_t theBlockSize;
+  };
+
+  // Encodes aItems into aOut, using a pooled processor with aVocabs
+  // loaded: as one CSX document, or as indexed segments. Given aIndex, the
+  // index read from the file aOut writes to, the segments are appended to
+  // it; csx:CSX0006 is raised if its vocabularies differ from aVocabs.
+  void serializeItems(ProcessorPool& aPool, const vector<String>& aVocabs,
+                      Iterator_t aItems, std::ostream& aOut,
+                      const SerializeOptions& aOptions = SerializeOptions(),
+                      SegmentIndex* aIndex = 0);
+
+  // Writes aItems as one CSX document to the file aPath, through two
+  // buffers of aBufferSize bytes (0 for the default of 1 MiB) that a
+  // writer thread flushes while the other is being filled. Raises
+  // csx:CSX0002 if the file cannot be opened or written.
+  void serializeToFile(ProcessorPool& aPool, const vector<String>& aVocabs,
+                       Iterator_t aItems, const String& aPath, size_t aBufferSize);
+
+  // Wraps the bytes written to aBuffer into an xs:base64Binary item without
+  // copying them
+  Item createBinaryItem(OutputBuffer& aBuffer);
+
+  /**
+   * Walks an item()* and emits the corresponding events into a CSXHandler.
+   * The walk uses an explicit stack instead of recursion, and the frames and
+   * scratch values are reused from one node to the next.
+   */
+  class Traverser {
+    public:
+      Traverser(opencsx::CSXHandler* aHandler, Counters& aCounters)
+        : theHandler(aHandler), theCounters(aCounters) {}
+
+      void traverse(Iterator_t aItems);
+
     private:
-      opencsx::CSXProcessor* theProcessor;
+      // How typed content of elements of a given type is emitted
+      enum ContentKind {
+        UNKNOWN_CONTENT,
+        ATOMIZED_CONTENT,   // the typed value, plus non-text children
+        CHILD_CONTENT       // element-only: the children as they are
+      };
+
+      // The strings a QName is handed to the handler as
+      struct NameStrings {
+        string theUri;
+        string theLocalName;
+        string thePrefix;
+      };
+
+      // (namespace URI, (local name, prefix))
+      typedef std::pair<String, std::pair<String, String> > NameKey;
+
+      struct Frame {
+        Iterator_t theChildren;
+        const NameStrings* theName;   // null for the top-level sequence
+        bool theSkipText;
+        bool theUntyped;              // inside an xs:untyped element
+      };
+
+      void pushFrame(Iterator_t aChildren, const NameStrings* aName, bool aSkipText,
+                     bool aUntyped);
+      const NameStrings& getNameStrings(const Item& aName);
+      const opencsx::CSXHandler::NsBindings* getBindings(const Item& aElement);
+      const NameStrings& startElement(Item& aElement, bool aUntyped);
+      bool emitTypedValue(Item& aElement);
+      void emitAtomic(const Item& aItem);
+
+      opencsx::CSXHandler* theHandler;
+      Counters& theCounters;
+
+      vector<Frame> theStack;
+      // By type (namespace URI, local name)
+      std::map<std::pair<String, String>, ContentKind> theContentKinds;
+
+      // Every distinct QName is converted once per traversal; the entries
+      // stay where they are, so frames can point to them
+      std::map<NameKey, NameStrings> theNames;
+
+      // Scratch state reused for every node
+      Item theName;
+      Item theAttr;
+      Item theValue;
+      zorba::NsBindings theBindings;
+      // The last bindings converted, reused while elements keep declaring
+      // the same ones
+      zorba::NsBindings theLastBindings;
+      opencsx::CSXHandler::NsBindings theCsxBindings;
+      opencsx::AtomicValue theAtomic;
+  };
+
+  /**
+   * Receives the top-level items produced by a CSXParserHandler.
+   */
+  class ItemSink {
+    public:
+      virtual ~ItemSink() {}
+      virtual void push(const Item& aItem) = 0;
+  };
+
+  class VectorItemSink : public ItemSink {
+    public:
+      VectorItemSink(vector<Item>& aItems) : theItems(aItems) {}
+      virtual void push(const Item& aItem) { theItems.push_back(aItem); }
+    private:
+      vector<Item>& theItems;
   };
 
   class CSXParserHandler : public opencsx::CSXHandler {
@@ -105,27 +632,116 @@ namespace zorba { namespace csx {
       void atomicValue(const opencsx::AtomicValue &value);
       void processingInstruction(const string &target, const string &data);
       void comment(const string &chars);
-      CSXParserHandler(vector<Item>& aItems);
+      // With a projection, only the elements it keeps (and their
+      // ancestors) are built. Typed, nodes are annotated with the types of
+      // the values in the stream instead of xs:untyped. String values of
+      // aStreamThreshold bytes or more (if not 0) become streamable strings
+      // read from a temporary file.
+      CSXParserHandler(ItemSink& aSink, VocabProcessor& aProcessor,
+                       Projection* aProjection = 0, bool aTyped = false,
+                       size_t aStreamThreshold = 0);
       virtual ~CSXParserHandler();
+
+      // Time spent handing items to the sink, which may block
+      uint64_t getSinkTime() const { return m_sinkTime; }
     private:
       Item getAtomicItem(opencsx::AtomicValue const& v);
+      Item getStringItem(const string& aValue);
+      void buildElement(const string& uri, const string& localname,
+                        const string& prefix, const opencsx::CSXHandler::NsBindings* bindings);
+      void createDeferred(const Item& aType);
+      void finishElement();
+      void emit(const Item& aItem);
+      void buildPending();
+      bool isProjectedOut() const { return m_projection && m_keepDepth == 0; }
 
       ItemFactory* m_itemFactory;
 
+      // Interned QNames and binding lists, shared across parses
+      NameCache& m_names;
+
+      // Stacks and type names, shared across parses
+      ParseScratch& m_scratch;
+
+      // Type and item constructor of each kind of value, shared by all
+      // parses
+      const DecodePlan& m_plan;
+
+      Counters& m_counters;
+      uint64_t m_sinkTime;
+
       // Stack of constructed elements
-      vector<Item> m_elemStack;
+      vector<Item>& m_elemStack;
 
       // Output of parsing CSX
-      vector<Item>& m_result;
+      ItemSink& m_sink;
 
       // Collects AtomicValues for passing to assignElementTypedValue()
-      vector<Item> m_atomics;
+      vector<Item>& m_atomics;
 
       // Defaults for untyped values
-      Item m_defaultType;
-      Item m_defaultAttrType;
+      const Item& m_defaultType;
+      const Item& m_defaultAttrType;
+
+      // Projection, or null to build everything
+      Projection* m_projection;
+
+      // Nesting depth inside a subtree that is skipped or kept whole
+      size_t m_skipDepth;
+      size_t m_keepDepth;
+
+      // Open ancestors of possibly kept elements; only built once something
+      // below them is kept. Slots are reused.
+      typedef ParseScratch::PendingElement PendingElement;
+      vector<PendingElement>& m_pending;
+      size_t m_pendingCount;
+
+      // Typed mode: the element type is only known from its first content
+      // event, so the innermost started element and its attributes are kept
+      // here until then. m_deferredBindings points into m_names, which
+      // attribute() does not invalidate.
+      bool m_typed;
+      bool m_deferred;
+      Item m_deferredName;
+      const zorba::NsBindings* m_deferredBindings;
+      // Whether the last content of the open element was a typed-mode
+      // string, so the next one is the following item of a list
+      bool m_afterString;
+      vector<ParseScratch::DeferredAttribute>& m_deferredAttrs;
+
+      // Type of elements with complex content in typed mode
+      const Item& m_anyType;
+
+      // Smallest string value spilled to a file, or 0
+      size_t m_streamThreshold;
+  };
+
+  /**
+   * How csx:parse() builds its result.
+   */
+  struct ParseOptions {
+    ParseOptions() : theProjected(false), theTyped(false), theRanged(false) {}
+
+    // Only build the elements these paths select (see Projection)
+    bool theProjected;
+    vector<String> theProjection;
+
+    // Annotate nodes with the types of the values in the stream
+    bool theTyped;
+
+    // Only decode items theFirst to theLast (1-based, inclusive) of an
+    // indexed stream, skipping the segments that hold none of them
+    bool theRanged;
+    uint64_t theFirst;
+    uint64_t theLast;
   };
 
+  // Parses the whole of aSource into aSink, using a pooled processor with
+  // aVocabs loaded
+  void parseInto(ProcessorPool& aPool, const vector<String>& aVocabs,
+                 CSXSource& aSource, ItemSink& aSink,
+                 const ParseOptions& aOptions = ParseOptions());
+
 }/*csx namespace*/}/*zorba namespace*/
 
 
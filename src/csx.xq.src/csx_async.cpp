@@ -0,0 +1,215 @@
+#include <zorba/vector_item_sequence.h>
+#include <string.h>
+
+#include "csx.h"
+#include "csx_async.h"
+#include "csx_stats.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  AsyncFileBuffer::AsyncFileBuffer(size_t aBufferSize)
+    : theFile(0),
+      theFilling(0),
+      theSubmitted(0),
+      theClosing(false),
+      theFailed(false),
+      theWriteTime(0),
+      theWriter(*this)
+  {
+    for (size_t i = 0; i < 2; ++i) {
+      theBuffers[i].resize(aBufferSize > 0 ? aBufferSize : 1);
+      theSizes[i] = 0;
+    }
+    setp(&theBuffers[0][0], &theBuffers[0][0] + theBuffers[0].size());
+  }
+
+  AsyncFileBuffer::~AsyncFileBuffer()
+  {
+    close();
+  }
+
+  bool AsyncFileBuffer::open(const string& aPath)
+  {
+    theFile = fopen(aPath.c_str(), "wb");
+    if (!theFile) {
+      return false;
+    }
+    if (!theWriter.start()) {
+      fclose(theFile);
+      theFile = 0;
+      return false;
+    }
+    return true;
+  }
+
+  bool AsyncFileBuffer::close()
+  {
+    if (!theFile) {
+      return false;
+    }
+    submit();
+    {
+      ScopedLock lLock(theMutex);
+      theClosing = true;
+      theCondition.notifyAll();
+    }
+    theWriter.join();
+    if (fclose(theFile) != 0) {
+      theFailed = true;
+    }
+    theFile = 0;
+    return !theFailed;
+  }
+
+  void AsyncFileBuffer::submit()
+  {
+    size_t lSize = pptr() - pbase();
+    if (lSize == 0) {
+      return;
+    }
+    ScopedLock lLock(theMutex);
+    theSizes[theFilling] = lSize;
+    theSubmitted += lSize;
+    theCondition.notifyAll();
+    theFilling ^= 1;
+    while (theSizes[theFilling] != 0) {
+      theCondition.wait(theMutex);
+    }
+    vector<char>& lBuffer = theBuffers[theFilling];
+    setp(&lBuffer[0], &lBuffer[0] + lBuffer.size());
+  }
+
+  void AsyncFileBuffer::write()
+  {
+    // Buffers are submitted alternately, so they are written alternately
+    size_t lIndex = 0;
+    for (;;) {
+      size_t lSize;
+      {
+        ScopedLock lLock(theMutex);
+        while (theSizes[lIndex] == 0 && !theClosing) {
+          theCondition.wait(theMutex);
+        }
+        lSize = theSizes[lIndex];
+        if (lSize == 0) {
+          return;
+        }
+      }
+      // After a failure the rest is only discarded
+      bool lWritten = false;
+      if (!theFailed) {
+        uint64_t lStart = monotonicMicros();
+        lWritten = fwrite(&theBuffers[lIndex][0], 1, lSize, theFile) == lSize;
+        theWriteTime += monotonicMicros() - lStart;
+      }
+      {
+        ScopedLock lLock(theMutex);
+        if (!lWritten) {
+          theFailed = true;
+        }
+        theSizes[lIndex] = 0;
+        theCondition.notifyAll();
+      }
+      lIndex ^= 1;
+    }
+  }
+
+  AsyncFileBuffer::int_type AsyncFileBuffer::overflow(int_type c)
+  {
+    submit();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  streamsize AsyncFileBuffer::xsputn(const char* s, streamsize n)
+  {
+    streamsize lDone = 0;
+    while (lDone < n) {
+      size_t lFree = epptr() - pptr();
+      if (lFree == 0) {
+        submit();
+        continue;
+      }
+      size_t lCopy = (size_t)(n - lDone) < lFree ? (size_t)(n - lDone) : lFree;
+      memcpy(pptr(), s + lDone, lCopy);
+      pbump((int)lCopy);
+      lDone += lCopy;
+    }
+    return n;
+  }
+
+  int AsyncFileBuffer::sync()
+  {
+    submit();
+    ScopedLock lLock(theMutex);
+    return theFailed ? -1 : 0;
+  }
+
+  AsyncFileBuffer::pos_type
+  AsyncFileBuffer::seekoff(off_type off, ios_base::seekdir dir, ios_base::openmode which)
+  {
+    if (off != 0 || dir != ios_base::cur || !(which & ios_base::out)) {
+      return pos_type(off_type(-1));
+    }
+    return pos_type(off_type(theSubmitted + (pptr() - pbase())));
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  ExportJobs::~ExportJobs()
+  {
+    for (map<uint64_t, Job*>::iterator ite = theJobs.begin(); ite != theJobs.end(); ++ite) {
+      delete ite->second;
+    }
+  }
+
+  uint64_t ExportJobs::start(const vector<Item>& aItems, const String& aPath,
+                             const vector<String>& aVocabs, size_t aBufferSize)
+  {
+    Job* lJob = new Job(thePool, aItems, aPath, aVocabs, aBufferSize);
+    uint64_t lHandle;
+    {
+      ScopedLock lLock(theMutex);
+      lHandle = theNextHandle++;
+      theJobs[lHandle] = lJob;
+    }
+    lJob->launch();
+    return lHandle;
+  }
+
+  bool ExportJobs::wait(uint64_t aHandle, string& aError)
+  {
+    Job* lJob;
+    {
+      ScopedLock lLock(theMutex);
+      map<uint64_t, Job*>::iterator ite = theJobs.find(aHandle);
+      if (ite == theJobs.end()) {
+        return false;
+      }
+      lJob = ite->second;
+      theJobs.erase(ite);
+    }
+    lJob->join();
+    aError = lJob->getError();
+    delete lJob;
+    return true;
+  }
+
+  void ExportJobs::Job::run()
+  {
+    try {
+      ItemSequence_t lItems(new VectorItemSequence(theItems));
+      serializeToFile(thePool, theVocabs, lItems->getIterator(), thePath, theBufferSize);
+    }
+    catch (exception& e) {
+      theError = e.what();
+    }
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
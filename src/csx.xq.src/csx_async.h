@@ -0,0 +1,139 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_ASYNC_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_ASYNC_H__
+
+#include <zorba/zorba.h>
+#include <map>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "csx_sync.h"
+
+namespace zorba { namespace csx {
+
+  class ProcessorPool;
+
+  /**
+   * A streambuf that writes a file from a background thread. The encoder
+   * fills one of two buffers of a fixed size while the writer thread
+   * writes out the other, so it only waits for the disk when both are
+   * full. Reports the position written so far, for tellp().
+   */
+  class AsyncFileBuffer : public std::streambuf {
+    public:
+      AsyncFileBuffer(size_t aBufferSize);
+      virtual ~AsyncFileBuffer();
+
+      // Truncates aPath; false if it cannot be opened or the writer thread
+      // cannot be started
+      bool open(const std::string& aPath);
+
+      // Waits until everything is written and closes the file; false if
+      // any write failed
+      bool close();
+
+      // Time the writer thread spent writing, in microseconds
+      uint64_t getWriteTime() const { return theWriteTime; }
+
+    protected:
+      virtual int_type overflow(int_type c);
+      virtual std::streamsize xsputn(const char* s, std::streamsize n);
+      virtual int sync();
+      virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                               std::ios_base::openmode which);
+
+    private:
+      class Writer : public Thread {
+        public:
+          Writer(AsyncFileBuffer& aBuffer) : theBuffer(aBuffer) {}
+        protected:
+          virtual void run() { theBuffer.write(); }
+        private:
+          AsyncFileBuffer& theBuffer;
+      };
+
+      AsyncFileBuffer(const AsyncFileBuffer&);
+      AsyncFileBuffer& operator=(const AsyncFileBuffer&);
+
+      // Hands the buffer being filled to the writer and waits for the
+      // other one to be free
+      void submit();
+      // The writer thread
+      void write();
+
+      FILE* theFile;
+      std::vector<char> theBuffers[2];
+      size_t theSizes[2];          // bytes to write; 0 once written
+      size_t theFilling;
+      uint64_t theSubmitted;       // bytes handed to the writer
+      bool theClosing;
+      bool theFailed;
+      uint64_t theWriteTime;
+      Mutex theMutex;
+      Condition theCondition;
+      Writer theWriter;
+  };
+
+  /**
+   * Exports started by csx:serialize-async(), each writing its file on a
+   * thread of its own until csx:wait() joins it.
+   */
+  class ExportJobs {
+    public:
+      ExportJobs(ProcessorPool& aPool) : thePool(aPool), theNextHandle(1) {}
+      // Waits for the exports nobody has waited for
+      ~ExportJobs();
+
+      // aItems must not change while the export runs; returns its handle
+      uint64_t start(const std::vector<Item>& aItems, const String& aPath,
+                     const std::vector<String>& aVocabs, size_t aBufferSize);
+
+      // Joins the export; false if aHandle is unknown. aError is the
+      // message it failed with, or empty.
+      bool wait(uint64_t aHandle, std::string& aError);
+
+    private:
+      class Job : public Thread {
+        public:
+          Job(ProcessorPool& aPool, const std::vector<Item>& aItems, const String& aPath,
+              const std::vector<String>& aVocabs, size_t aBufferSize)
+            : thePool(aPool), theItems(aItems), thePath(aPath), theVocabs(aVocabs),
+              theBufferSize(aBufferSize) {}
+          virtual ~Job() { join(); }
+
+          const std::string& getError() const { return theError; }
+
+          // Runs the export on the calling thread if no thread can be
+          // started for it
+          void launch() {
+            if (!start()) {
+              run();
+            }
+          }
+
+        protected:
+          virtual void run();
+
+        private:
+          ProcessorPool& thePool;
+          std::vector<Item> theItems;
+          String thePath;
+          std::vector<String> theVocabs;
+          size_t theBufferSize;
+          std::string theError;
+      };
+
+      ExportJobs(const ExportJobs&);
+      ExportJobs& operator=(const ExportJobs&);
+
+      ProcessorPool& thePool;
+      Mutex theMutex;
+      std::map<uint64_t, Job*> theJobs;
+      uint64_t theNextHandle;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_ASYNC_H__
@@ -0,0 +1,235 @@
+#include <zlib.h>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string.h>
+
+#include "csx.h"
+#include "csx_container.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  const char BlockContainer::MAGIC[8] = { 'C', 'S', 'X', 'Z', 'B', 'L', 'K', '1' };
+
+  static void putUInt64(char* aTarget, uint64_t aValue)
+  {
+    for (int i = 0; i < 8; ++i) {
+      aTarget[i] = (char)(aValue >> (8 * i));
+    }
+  }
+
+  static uint64_t getUInt64(const char* aSource)
+  {
+    uint64_t lValue = 0;
+    for (int i = 7; i >= 0; --i) {
+      lValue = (lValue << 8) | (unsigned char)aSource[i];
+    }
+    return lValue;
+  }
+
+  static const size_t BLOCK_HEADER_SIZE = 24;
+  static const size_t TRAILER_SIZE = 24;
+  // zlib never inflates data more than about 1032 times
+  static const uint64_t MAX_INFLATION = 1040;
+
+  namespace {
+
+    // Compresses block aIndex into a buffer of its own, header included
+    class CompressTask : public ParallelTask {
+      public:
+        CompressTask(const char* aData, size_t aSize, size_t aBlockSize,
+                     vector<vector<char> >& aBlocks)
+          : theData(aData), theSize(aSize), theBlockSize(aBlockSize), theBlocks(aBlocks) {}
+
+        virtual void run(size_t aIndex) {
+          size_t lBegin = aIndex * theBlockSize;
+          size_t lSize = min(theBlockSize, theSize - lBegin);
+          vector<char>& lBlock = theBlocks[aIndex];
+          uLongf lCompressed = compressBound((uLong)lSize);
+          lBlock.resize(BLOCK_HEADER_SIZE + lCompressed);
+          if (compress2((Bytef*)&lBlock[BLOCK_HEADER_SIZE], &lCompressed,
+                        (const Bytef*)theData + lBegin, (uLong)lSize,
+                        Z_DEFAULT_COMPRESSION) != Z_OK) {
+            throw runtime_error("cannot compress CSX block");
+          }
+          lBlock.resize(BLOCK_HEADER_SIZE + lCompressed);
+          putUInt64(&lBlock[0], lCompressed);
+          putUInt64(&lBlock[8], lSize);
+          putUInt64(&lBlock[16], lBegin);
+        }
+
+      private:
+        const char* theData;
+        size_t theSize;
+        size_t theBlockSize;
+        vector<vector<char> >& theBlocks;
+    };
+
+    // Where a block lies in the container and in the decompressed data
+    struct Block {
+      uint64_t theOffset;
+      uint64_t theCompressed;
+      uint64_t theSize;
+      uint64_t theBegin;
+    };
+
+    // Decompresses block aIndex of aContainer into its place in aData; the
+    // blocks have been checked to fit both
+    class DecompressTask : public ParallelTask {
+      public:
+        DecompressTask(const vector<char>& aContainer, const vector<Block>& aBlocks,
+                       vector<char>& aData)
+          : theContainer(aContainer), theBlocks(aBlocks), theData(aData) {}
+
+        virtual void run(size_t aIndex) {
+          const Block& lBlock = theBlocks[aIndex];
+          uLongf lInflated = (uLongf)lBlock.theSize;
+          const char* lCompressed = &theContainer[(size_t)lBlock.theOffset] + BLOCK_HEADER_SIZE;
+          if (lBlock.theSize > 0 &&
+              (uncompress((Bytef*)&theData[(size_t)lBlock.theBegin], &lInflated,
+                          (const Bytef*)lCompressed, (uLong)lBlock.theCompressed) != Z_OK ||
+               lInflated != lBlock.theSize)) {
+            throw runtime_error("damaged CSX container block");
+          }
+        }
+
+      private:
+        const vector<char>& theContainer;
+        const vector<Block>& theBlocks;
+        vector<char>& theData;
+    };
+
+  }
+
+  void BlockContainer::write(const char* aData, size_t aSize, ostream& aOut,
+                             size_t aBlockSize, unsigned aThreads)
+  {
+    size_t lBlockSize = aBlockSize > 0 ? aBlockSize : DEFAULT_BLOCK_SIZE;
+    size_t lCount = (aSize + lBlockSize - 1) / lBlockSize;
+    vector<vector<char> > lBlocks(lCount);
+    CompressTask lTask(aData, aSize, lBlockSize, lBlocks);
+    string lError = parallelFor(lCount, aThreads, lTask);
+    if (!lError.empty()) {
+      CSXModule::raiseError("CSX0003", lError);
+    }
+
+    vector<char> lTable(lCount * 8 + TRAILER_SIZE);
+    uint64_t lOffset = 0;
+    for (size_t i = 0; i < lCount; ++i) {
+      putUInt64(&lTable[i * 8], lOffset);
+      aOut.write(&lBlocks[i][0], (streamsize)lBlocks[i].size());
+      lOffset += lBlocks[i].size();
+      vector<char>().swap(lBlocks[i]);
+    }
+    char* lTrailer = &lTable[lCount * 8];
+    putUInt64(lTrailer, aSize);
+    putUInt64(lTrailer + 8, lCount);
+    memcpy(lTrailer + 16, MAGIC, sizeof(MAGIC));
+    aOut.write(&lTable[0], (streamsize)lTable.size());
+  }
+
+  bool BlockContainer::read(istream& aStream, vector<char>& aData, unsigned aThreads)
+  {
+    streampos lStart = aStream.tellg();
+    if (lStart == streampos(-1)) {
+      aStream.clear();
+      return false;
+    }
+    char lTrailer[TRAILER_SIZE];
+    uint64_t lEnd = 0;
+    bool lFound = aStream.seekg(0, ios::end) &&
+      (lEnd = (uint64_t)(streamoff)aStream.tellg()) >= TRAILER_SIZE &&
+      aStream.seekg((streamoff)(lEnd - TRAILER_SIZE)) &&
+      aStream.read(lTrailer, TRAILER_SIZE) &&
+      memcmp(lTrailer + 16, MAGIC, sizeof(MAGIC)) == 0;
+    aStream.clear();
+    if (!lFound) {
+      aStream.seekg(lStart);
+      return false;
+    }
+
+    uint64_t lSize = getUInt64(lTrailer);
+    uint64_t lCount = getUInt64(lTrailer + 8);
+    if (lCount > (lEnd - TRAILER_SIZE) / (8 + BLOCK_HEADER_SIZE)) {
+      CSXModule::raiseError("CSX0005", "damaged CSX container");
+    }
+    uint64_t lBlocksEnd = lEnd - TRAILER_SIZE - lCount * 8;
+    vector<char> lContainer((size_t)(lEnd - TRAILER_SIZE));
+    aStream.seekg(0);
+    if (!lContainer.empty() && !aStream.read(&lContainer[0], (streamsize)lContainer.size())) {
+      CSXModule::raiseError("CSX0005", "truncated CSX container");
+    }
+    // The blocks must follow each other, in the container and in the
+    // data, and add up to the size in the trailer; only then is that much
+    // memory allocated
+    vector<Block> lBlocks((size_t)lCount);
+    uint64_t lNextOffset = 0;
+    uint64_t lNextBegin = 0;
+    for (size_t i = 0; i < lBlocks.size(); ++i) {
+      Block& lBlock = lBlocks[i];
+      lBlock.theOffset = getUInt64(&lContainer[(size_t)(lBlocksEnd + i * 8)]);
+      if (lBlock.theOffset != lNextOffset || lBlocksEnd - lNextOffset < BLOCK_HEADER_SIZE) {
+        CSXModule::raiseError("CSX0005", "damaged CSX container");
+      }
+      const char* lHeader = &lContainer[(size_t)lBlock.theOffset];
+      lBlock.theCompressed = getUInt64(lHeader);
+      lBlock.theSize = getUInt64(lHeader + 8);
+      lBlock.theBegin = getUInt64(lHeader + 16);
+      if (lBlock.theCompressed > lBlocksEnd - lNextOffset - BLOCK_HEADER_SIZE ||
+          lBlock.theBegin != lNextBegin || lBlock.theSize > lSize - lNextBegin ||
+          lBlock.theSize / MAX_INFLATION > lBlock.theCompressed) {
+        CSXModule::raiseError("CSX0005", "damaged CSX container");
+      }
+      lNextOffset += BLOCK_HEADER_SIZE + lBlock.theCompressed;
+      lNextBegin += lBlock.theSize;
+    }
+    if (lNextOffset != lBlocksEnd || lNextBegin != lSize) {
+      CSXModule::raiseError("CSX0005", "damaged CSX container");
+    }
+    lContainer.resize((size_t)lBlocksEnd);
+
+    aData.resize((size_t)lSize);
+    DecompressTask lTask(lContainer, lBlocks, aData);
+    string lError = parallelFor(lBlocks.size(), aThreads, lTask);
+    if (!lError.empty()) {
+      CSXModule::raiseError("CSX0005", lError);
+    }
+    aStream.seekg(lStart);
+    return true;
+  }
+
+  CSXInput* DecompressedSource::open()
+  {
+    return new MemoryInput(theData.empty() ? 0 : &theData[0], theData.size());
+  }
+
+  namespace {
+
+    class DecompressedInput : public CSXInput {
+      public:
+        DecompressedInput() : theStream(&theBuffer) {}
+        std::vector<char>& data() { return theData; }
+        void reset() { theBuffer.reset(theData.empty() ? 0 : &theData[0], theData.size()); }
+        virtual std::istream& stream() { return theStream; }
+      private:
+        std::vector<char> theData;
+        MemoryInputBuffer theBuffer;
+        std::istream theStream;
+    };
+
+  }
+
+  CSXInput* openCSX(CSXSource& aSource, unsigned aThreads)
+  {
+    auto_ptr<CSXInput> lInput(aSource.open());
+    auto_ptr<DecompressedInput> lDecompressed(new DecompressedInput());
+    if (!BlockContainer::read(lInput->stream(), lDecompressed->data(), aThreads)) {
+      return lInput.release();
+    }
+    lDecompressed->reset();
+    return lDecompressed.release();
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
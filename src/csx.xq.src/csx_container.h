@@ -0,0 +1,66 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_CONTAINER_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_CONTAINER_H__
+
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <stdint.h>
+
+#include "csx_streams.h"
+
+namespace zorba { namespace csx {
+
+  /**
+   * A CSX stream cut into blocks that are compressed with zlib one by one,
+   * so that they can be compressed and decompressed in parallel:
+   *
+   *   block 1 ... block N
+   *   offset of block 1 ... offset of block N
+   *   size of the CSX stream
+   *   N
+   *   "CSXZBLK1"
+   *
+   * Each block starts with a header of its compressed size, its size
+   * uncompressed and where in the CSX stream it belongs, followed by its
+   * deflate data. All numbers are 64-bit little-endian integers. Like an
+   * indexed stream, a container is recognized by how it ends; the stream
+   * inside may itself be indexed.
+   */
+  class BlockContainer {
+    public:
+      static const size_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+
+      // Compresses the aSize bytes at aData into aOut, using up to aThreads
+      // threads
+      static void write(const char* aData, size_t aSize, std::ostream& aOut,
+                        size_t aBlockSize, unsigned aThreads);
+
+      // If aStream holds a container, decompresses it into aData, using up
+      // to aThreads threads, and returns true. Otherwise returns false and
+      // leaves aStream where it was. Raises csx:CSX0005 if the container
+      // is damaged.
+      static bool read(std::istream& aStream, std::vector<char>& aData, unsigned aThreads);
+
+    private:
+      static const char MAGIC[8];
+  };
+
+  /**
+   * The CSX stream held by a container, decompressed once and then opened
+   * as often as needed, from any thread.
+   */
+  class DecompressedSource : public CSXSource {
+    public:
+      std::vector<char>& data() { return theData; }
+      virtual CSXInput* open();
+    private:
+      std::vector<char> theData;
+  };
+
+  // Opens aSource. If it holds a container, returns an input over its CSX
+  // stream instead, decompressed with up to aThreads threads.
+  CSXInput* openCSX(CSXSource& aSource, unsigned aThreads);
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_CONTAINER_H__
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <string.h>
+
+#include "csx_index.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  const char SegmentIndex::MAGIC[8] = { 'C', 'S', 'X', 'I', 'N', 'D', 'X', '1' };
+
+  static void putUInt64(char* aTarget, uint64_t aValue)
+  {
+    for (int i = 0; i < 8; ++i) {
+      aTarget[i] = (char)(aValue >> (8 * i));
+    }
+  }
+
+  static uint64_t getUInt64(const char* aSource)
+  {
+    uint64_t lValue = 0;
+    for (int i = 7; i >= 0; --i) {
+      lValue = (lValue << 8) | (unsigned char)aSource[i];
+    }
+    return lValue;
+  }
+
+  // The fixed part at the end of every block
+  static const size_t BLOCK_TAIL_SIZE = 32;
+
+  bool SegmentIndex::readBlocks(istream& aStream, uint64_t aEnd)
+  {
+    theBegins.clear();
+    theEnds.clear();
+    theItems.clear();
+
+    // Newest block first; each block's segments are added in reverse and
+    // everything is turned around at the end
+    uint64_t lEnd = aEnd;
+    bool lLast = true;
+    char lTail[BLOCK_TAIL_SIZE];
+    vector<char> lBlock;
+    while (true) {
+      if (lEnd < BLOCK_TAIL_SIZE ||
+          !aStream.seekg((streamoff)(lEnd - BLOCK_TAIL_SIZE)) ||
+          !aStream.read(lTail, BLOCK_TAIL_SIZE) ||
+          memcmp(lTail + 24, MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+      }
+      uint64_t lPrevious = getUInt64(lTail);
+      uint64_t lCount = getUInt64(lTail + 16);
+      if (lLast) {
+        theVocabulary = getUInt64(lTail + 8);
+        lLast = false;
+      }
+      uint64_t lBlockSize = (2 * lCount + 1) * 8;
+      if (lCount >= lEnd / 16 || lBlockSize + BLOCK_TAIL_SIZE > lEnd - lPrevious) {
+        return false;
+      }
+      uint64_t lBlockStart = lEnd - BLOCK_TAIL_SIZE - lBlockSize;
+      lBlock.resize((size_t)lBlockSize);
+      if (!aStream.seekg((streamoff)lBlockStart) ||
+          !aStream.read(&lBlock[0], (streamsize)lBlockSize)) {
+        return false;
+      }
+
+      // Segments lie between the previous block and this one, in order
+      uint64_t lNext = getUInt64(&lBlock[lCount * 8]);
+      if (lNext > lBlockStart) {
+        return false;
+      }
+      for (size_t i = (size_t)lCount; i-- > 0; ) {
+        uint64_t lBegin = getUInt64(&lBlock[i * 8]);
+        if (lBegin < lPrevious || lBegin > lNext) {
+          return false;
+        }
+        theBegins.push_back(lBegin);
+        theEnds.push_back(lNext);
+        theItems.push_back(getUInt64(&lBlock[(lCount + 1 + i) * 8]));
+        lNext = lBegin;
+      }
+
+      if (lPrevious == 0) {
+        break;
+      }
+      lEnd = lPrevious;
+    }
+
+    reverse(theBegins.begin(), theBegins.end());
+    reverse(theEnds.begin(), theEnds.end());
+    reverse(theItems.begin(), theItems.end());
+    theWritten = theItems.size();
+    theBlockEnd = aEnd;
+    return true;
+  }
+
+  bool SegmentIndex::read(istream& aStream)
+  {
+    streampos lStart = aStream.tellg();
+    if (lStart == streampos(-1)) {
+      aStream.clear();
+      return false;
+    }
+
+    bool lFound = false;
+    if (aStream.seekg(0, ios::end)) {
+      lFound = readBlocks(aStream, (uint64_t)(streamoff)aStream.tellg());
+    }
+    if (!lFound) {
+      *this = SegmentIndex();
+    }
+
+    aStream.clear();
+    aStream.seekg(lStart);
+    return lFound;
+  }
+
+  bool SegmentIndex::recover(istream& aStream)
+  {
+    if (read(aStream)) {
+      return true;
+    }
+    streampos lStart = aStream.tellg();
+    if (lStart == streampos(-1) || !aStream.seekg(0, ios::end)) {
+      aStream.clear();
+      return false;
+    }
+
+    // Look for the magic of a block from the end backwards, a window at a
+    // time; windows overlap so that a magic across their border is seen
+    uint64_t lSize = (uint64_t)(streamoff)aStream.tellg();
+    const uint64_t lWindowSize = 64 * 1024;
+    vector<char> lWindow;
+    bool lFound = false;
+    uint64_t lPos = lSize;
+    while (lPos > 0 && !lFound) {
+      uint64_t lWindowStart = lPos > lWindowSize ? lPos - lWindowSize : 0;
+      uint64_t lWindowEnd = min(lPos + sizeof(MAGIC) - 1, lSize);
+      lWindow.resize((size_t)(lWindowEnd - lWindowStart));
+      aStream.clear();
+      if (!aStream.seekg((streamoff)lWindowStart) ||
+          !aStream.read(&lWindow[0], (streamsize)lWindow.size())) {
+        break;
+      }
+      for (size_t i = (size_t)(lPos - lWindowStart); i-- > 0 && !lFound; ) {
+        if (i + sizeof(MAGIC) <= lWindow.size() &&
+            memcmp(&lWindow[i], MAGIC, sizeof(MAGIC)) == 0) {
+          aStream.clear();
+          lFound = readBlocks(aStream, lWindowStart + i + sizeof(MAGIC));
+        }
+      }
+      lPos = lWindowStart;
+    }
+    if (!lFound) {
+      *this = SegmentIndex();
+    }
+
+    aStream.clear();
+    aStream.seekg(lStart);
+    return lFound;
+  }
+
+  uint64_t SegmentIndex::totalItems() const
+  {
+    uint64_t lTotal = 0;
+    for (size_t i = 0; i < theItems.size(); ++i) {
+      lTotal += theItems[i];
+    }
+    return lTotal;
+  }
+
+  void SegmentIndex::addSegment(uint64_t aOffset, uint64_t aItems)
+  {
+    // A segment ends where the next one starts; the last of a block ends
+    // where the block does
+    if (theItems.size() > theWritten) {
+      theEnds.back() = aOffset;
+    }
+    theBegins.push_back(aOffset);
+    theEnds.push_back(aOffset);
+    theItems.push_back(aItems);
+  }
+
+  void SegmentIndex::write(ostream& aStream, uint64_t aEnd)
+  {
+    size_t lCount = theItems.size() - theWritten;
+    vector<char> lBlock((2 * lCount + 1) * 8 + BLOCK_TAIL_SIZE);
+    char* lPos = &lBlock[0];
+    for (size_t i = theWritten; i < theItems.size(); ++i, lPos += 8) {
+      putUInt64(lPos, theBegins[i]);
+    }
+    putUInt64(lPos, aEnd);
+    lPos += 8;
+    for (size_t i = theWritten; i < theItems.size(); ++i, lPos += 8) {
+      putUInt64(lPos, theItems[i]);
+    }
+    putUInt64(lPos, theBlockEnd);
+    putUInt64(lPos + 8, theVocabulary);
+    putUInt64(lPos + 16, lCount);
+    memcpy(lPos + 24, MAGIC, sizeof(MAGIC));
+    aStream.write(&lBlock[0], (streamsize)lBlock.size());
+
+    if (lCount > 0) {
+      theEnds.back() = aEnd;
+    }
+    theWritten = theItems.size();
+    theBlockEnd = aEnd + lBlock.size();
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
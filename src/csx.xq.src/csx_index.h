@@ -0,0 +1,78 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_INDEX_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_INDEX_H__
+
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <stdint.h>
+
+namespace zorba { namespace csx {
+
+  /**
+   * The index of an indexed CSX stream. Such a stream is a series of
+   * segments, each a standalone CSX document holding one or more top-level
+   * items, and index blocks. A block lists the segments written just
+   * before it:
+   *
+   *   offset of segment 1 ... offset of segment N, end of segment N
+   *   items in segment 1 ... items in segment N
+   *   end of the previous block, or 0 for the first
+   *   vocabulary fingerprint
+   *   N
+   *   "CSXINDX1"
+   *
+   * where offsets and counts are 64-bit little-endian integers. Readers
+   * find the last block from the end of the stream and follow the chain
+   * back, so any segment can be decoded without touching the ones before
+   * it. Appending adds segments and a block after the last block and
+   * never rewrites what is there; whatever lies between a block and the
+   * next segment is skipped.
+   */
+  class SegmentIndex {
+    public:
+      SegmentIndex() : theWritten(0), theBlockEnd(0), theVocabulary(0) {}
+
+      // Reads the blocks of aStream. Returns false, leaving the stream
+      // where it was, if aStream cannot seek or does not end with a block.
+      bool read(std::istream& aStream);
+
+      // Like read(), but for a stream with an incomplete write at the end:
+      // finds the last complete block, wherever it is. Scans the whole
+      // stream if there is none.
+      bool recover(std::istream& aStream);
+
+      size_t count() const { return theItems.size(); }
+      uint64_t begin(size_t aSegment) const { return theBegins[aSegment]; }
+      uint64_t end(size_t aSegment) const { return theEnds[aSegment]; }
+      uint64_t items(size_t aSegment) const { return theItems[aSegment]; }
+      uint64_t totalItems() const;
+
+      // Identifies the vocabularies the segments were encoded with
+      uint64_t getVocabulary() const { return theVocabulary; }
+      void setVocabulary(uint64_t aVocabulary) { theVocabulary = aVocabulary; }
+
+      // Records a segment that starts at aOffset and holds aItems items
+      void addSegment(uint64_t aOffset, uint64_t aItems);
+
+      // Writes a block for the segments added since the last read() or
+      // write(); aEnd is where the last of them ended, and where the block
+      // is written
+      void write(std::ostream& aStream, uint64_t aEnd);
+
+    private:
+      static const char MAGIC[8];
+
+      // Reads the chain of blocks of which the last ends at aEnd
+      bool readBlocks(std::istream& aStream, uint64_t aEnd);
+
+      std::vector<uint64_t> theBegins;
+      std::vector<uint64_t> theEnds;
+      std::vector<uint64_t> theItems;
+      size_t theWritten;        // segments already listed in a block
+      uint64_t theBlockEnd;     // end of the last block
+      uint64_t theVocabulary;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_INDEX_H__
@@ -0,0 +1,72 @@
+#include "csx_names.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  NameCache::NameCache(Counters& aCounters)
+    : theFactory(Zorba::getInstance(0)->getItemFactory()),
+      theQNameCount(0),
+      theCounters(aCounters)
+  {
+  }
+
+  const Item& NameCache::getQName(const string& aUri, const string& aPrefix,
+                                  const string& aLocalName)
+  {
+    QNameMap::iterator lBucket = theQNames.find(aLocalName);
+    if (lBucket != theQNames.end()) {
+      vector<QNameEntry>& lEntries = lBucket->second;
+      for (vector<QNameEntry>::iterator ite = lEntries.begin(); ite != lEntries.end(); ++ite) {
+        if (ite->theUri == aUri && ite->thePrefix == aPrefix) {
+          ++theCounters.theNameHits;
+          return ite->theQName;
+        }
+      }
+    }
+
+    ++theCounters.theNameMisses;
+    if (theQNameCount >= MAX_ENTRIES) {
+      theQNames.clear();
+      theQNameCount = 0;
+      lBucket = theQNames.end();
+    }
+    if (lBucket == theQNames.end()) {
+      lBucket = theQNames.insert(make_pair(aLocalName, vector<QNameEntry>())).first;
+    }
+    QNameEntry lEntry;
+    lEntry.theUri = aUri;
+    lEntry.thePrefix = aPrefix;
+    lEntry.theQName = theFactory->createQName(zorba::String(aUri), zorba::String(aPrefix),
+                                              zorba::String(aLocalName));
+    lBucket->second.push_back(lEntry);
+    ++theQNameCount;
+    return lBucket->second.back().theQName;
+  }
+
+  const zorba::NsBindings& NameCache::getBindings(const opencsx::CSXHandler::NsBindings* aBindings)
+  {
+    if (!aBindings || aBindings->empty()) {
+      return theNoBindings;
+    }
+    BindingsMap::iterator ite = theBindings.find(*aBindings);
+    if (ite != theBindings.end()) {
+      ++theCounters.theNameHits;
+      return ite->second;
+    }
+
+    ++theCounters.theNameMisses;
+    if (theBindings.size() >= MAX_ENTRIES) {
+      theBindings.clear();
+    }
+    zorba::NsBindings& lBindings = theBindings[*aBindings];
+    opencsx::CSXHandler::NsBindings::const_iterator lIte = aBindings->begin();
+    opencsx::CSXHandler::NsBindings::const_iterator lEnd = aBindings->end();
+    for (; lIte != lEnd; ++lIte) {
+      lBindings.push_back(pair<zorba::String,zorba::String>
+                          (zorba::String(lIte->first), zorba::String(lIte->second)));
+    }
+    return lBindings;
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
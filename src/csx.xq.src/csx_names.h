@@ -0,0 +1,57 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_NAMES_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_NAMES_H__
+
+#include <zorba/zorba.h>
+#include <zorba/item_factory.h>
+#include <opencsx/csxhandler.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "csx_stats.h"
+
+namespace zorba { namespace csx {
+
+  /**
+   * Interns the QName items and namespace binding lists built while parsing.
+   * CSX streams use few distinct names, so after warm-up startElement() and
+   * attribute() neither convert strings nor call createQName(). A cache
+   * belongs to one VocabProcessor and is only used by whoever has it
+   * checked out, so it needs no locking.
+   */
+  class NameCache {
+    public:
+      // Lookups are counted in aCounters
+      NameCache(Counters& aCounters);
+
+      // Lookups only compare against the strings OpenCSX passes in; nothing
+      // is allocated on a hit.
+      const Item& getQName(const std::string& aUri, const std::string& aPrefix,
+                           const std::string& aLocalName);
+      const zorba::NsBindings& getBindings(const opencsx::CSXHandler::NsBindings* aBindings);
+
+    private:
+      struct QNameEntry {
+        std::string theUri;
+        std::string thePrefix;
+        Item theQName;
+      };
+
+      typedef std::map<std::string, std::vector<QNameEntry> > QNameMap;
+      typedef std::map<opencsx::CSXHandler::NsBindings, zorba::NsBindings> BindingsMap;
+
+      // Upper bound on cached entries, for streams with unbounded names
+      static const size_t MAX_ENTRIES = 8192;
+
+      ItemFactory* theFactory;
+      QNameMap theQNames;
+      size_t theQNameCount;
+      BindingsMap theBindings;
+      zorba::NsBindings theNoBindings;
+      Counters& theCounters;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_NAMES_H__
@@ -0,0 +1,171 @@
+#include <zorba/zorba_exception.h>
+
+#include <exception>
+#include <memory>
+
+#include "csx_parse_sequence.h"
+#include "csx_streams.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  Iterator_t ParseSequence::getIterator()
+  {
+    return new ParseIterator(thePool, theSource, theVocabs, theOptions);
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  ParseIterator::ParseIterator(ProcessorPool& aPool, CSXSource_t aSource,
+                               const vector<String>& aVocabs,
+                               const ParseOptions& aOptions)
+    : thePool(aPool),
+      theSource(aSource),
+      theVocabs(aVocabs),
+      theOptions(aOptions),
+      theIsOpen(false),
+      theHasItem(false),
+      theWant(false),
+      theAbort(false),
+      theDone(false),
+      theEager(false),
+      theNext(0),
+      theZorbaError(0)
+  {
+  }
+
+  ParseIterator::~ParseIterator()
+  {
+    close();
+    delete theZorbaError;
+  }
+
+  void ParseIterator::open()
+  {
+    close();
+    theHasItem = false;
+    theWant = false;
+    theAbort = false;
+    theDone = false;
+    delete theZorbaError;
+    theZorbaError = 0;
+    theError.clear();
+    // The thread just waits for the first next() call
+    if (!start()) {
+      theEager = true;
+      VectorItemSink lSink(theItems);
+      decode(lSink);
+      theDone = true;
+    }
+    theIsOpen = true;
+  }
+
+  bool ParseIterator::next(Item& aItem)
+  {
+    if (!theIsOpen) {
+      return false;
+    }
+    if (theEager) {
+      if (theNext < theItems.size()) {
+        aItem = theItems[theNext];
+        theItems[theNext++] = Item();
+        return true;
+      }
+    }
+    else {
+      ScopedLock lLock(theMutex);
+      if (!theDone) {
+        theWant = true;
+        theCondition.notifyAll();
+        while (!theHasItem && !theDone) {
+          theCondition.wait(theMutex);
+        }
+      }
+      if (theHasItem) {
+        aItem = theItem;
+        theItem = Item();
+        theHasItem = false;
+        return true;
+      }
+    }
+    if (theZorbaError) {
+      auto_ptr<ZorbaException> lError(theZorbaError);
+      theZorbaError = 0;
+      lError->polymorphic_throw();
+    }
+    if (!theError.empty()) {
+      string lError;
+      lError.swap(theError);
+      CSXModule::raiseError("CSX0001", lError);
+    }
+    return false;
+  }
+
+  void ParseIterator::close()
+  {
+    if (isStarted()) {
+      {
+        ScopedLock lLock(theMutex);
+        theAbort = true;
+        theCondition.notifyAll();
+      }
+      join();
+    }
+    theItem = Item();
+    theItems.clear();
+    theNext = 0;
+    theEager = false;
+    theIsOpen = false;
+  }
+
+  void ParseIterator::push(const Item& aItem)
+  {
+    ScopedLock lLock(theMutex);
+    theItem = aItem;
+    theHasItem = true;
+    theWant = false;
+    theCondition.notifyAll();
+    while (!theWant && !theAbort) {
+      theCondition.wait(theMutex);
+    }
+    if (theAbort) {
+      throw Aborted();
+    }
+  }
+
+  void ParseIterator::run()
+  {
+    {
+      ScopedLock lLock(theMutex);
+      while (!theWant && !theAbort) {
+        theCondition.wait(theMutex);
+      }
+    }
+
+    if (!theAbort) {
+      decode(*this);
+    }
+
+    ScopedLock lLock(theMutex);
+    theDone = true;
+    theCondition.notifyAll();
+  }
+
+  void ParseIterator::decode(ItemSink& aSink)
+  {
+    try {
+      parseInto(thePool, theVocabs, *theSource, aSink, theOptions);
+    }
+    catch (Aborted&) {
+    }
+    catch (ZorbaException& ze) {
+      theZorbaError = ze.clone().release();
+    }
+    catch (exception& e) {
+      theError = e.what();
+    }
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
@@ -0,0 +1,88 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_PARSE_SEQUENCE_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_PARSE_SEQUENCE_H__
+
+#include <zorba/zorba.h>
+#include <zorba/iterator.h>
+#include <zorba/zorba_exception.h>
+#include <string>
+#include <vector>
+
+#include "csx.h"
+#include "csx_pool.h"
+#include "csx_streams.h"
+#include "csx_sync.h"
+
+namespace zorba { namespace csx {
+
+  /**
+   * The result of csx:parse(). Decoding is driven by the consumer: each
+   * iterator runs the OpenCSX parser on a helper thread which hands over
+   * every top-level element as soon as it is complete and then waits until
+   * the next one is asked for. Only one of the two threads ever runs at a
+   * time, so Zorba is never entered concurrently, and only the element
+   * being built is held in memory. If no thread can be created, the whole
+   * stream is decoded by open() instead and its items held until taken.
+   */
+  class ParseSequence : public ItemSequence {
+    public:
+      ParseSequence(ProcessorPool& aPool, CSXSource_t aSource,
+                    const std::vector<String>& aVocabs,
+                    const ParseOptions& aOptions = ParseOptions())
+        : thePool(aPool), theSource(aSource), theVocabs(aVocabs), theOptions(aOptions) {}
+
+      virtual Iterator_t getIterator();
+
+    private:
+      ProcessorPool& thePool;
+      CSXSource_t theSource;
+      std::vector<String> theVocabs;
+      ParseOptions theOptions;
+  };
+
+  class ParseIterator : public Iterator, private Thread, private ItemSink {
+    public:
+      ParseIterator(ProcessorPool& aPool, CSXSource_t aSource,
+                    const std::vector<String>& aVocabs,
+                    const ParseOptions& aOptions);
+      virtual ~ParseIterator();
+
+      virtual void open();
+      virtual bool next(Item& aItem);
+      virtual void close();
+      virtual bool isOpen() const { return theIsOpen; }
+
+    private:
+      // Thrown out of the parser when the consumer closes early
+      struct Aborted {};
+
+      virtual void run();
+      virtual void push(const Item& aItem);
+      // Runs the parser into aSink, keeping any error for next()
+      void decode(ItemSink& aSink);
+
+      ProcessorPool& thePool;
+      CSXSource_t theSource;
+      std::vector<String> theVocabs;
+      ParseOptions theOptions;
+
+      Mutex theMutex;
+      Condition theCondition;
+      Item theItem;
+      bool theIsOpen;
+      bool theHasItem;   // producer -> consumer: theItem is ready
+      bool theWant;      // consumer -> producer: parse up to the next item
+      bool theAbort;     // consumer -> producer: stop parsing
+      bool theDone;      // producer -> consumer: no more items
+      // Decoded by open() for want of a thread; theItems[theNext] is next
+      bool theEager;
+      std::vector<Item> theItems;
+      size_t theNext;
+      // Why parsing stopped early, raised by next() once the items before
+      // it have been taken
+      ZorbaException* theZorbaError;
+      std::string theError;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_PARSE_SEQUENCE_H__
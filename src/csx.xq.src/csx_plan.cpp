@@ -0,0 +1,233 @@
+#include <limits>
+
+#include "csx_plan.h"
+#include "csx_sync.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  // Parses the canonical lexical form of an xs:integer into aResult if it
+  // fits in 64 bits.
+  static bool integerFitsLong(const String& aLexical, int64_t& aResult)
+  {
+    const char* p = aLexical.c_str();
+    bool lNegative = (*p == '-');
+    if (lNegative || *p == '+') {
+      ++p;
+    }
+    if (!*p) {
+      return false;
+    }
+    // Accumulate negatively so that the minimum value fits too
+    const int64_t lMin = numeric_limits<int64_t>::min();
+    int64_t lValue = 0;
+    for (; *p; ++p) {
+      if (*p < '0' || *p > '9') {
+        return false;
+      }
+      int lDigit = *p - '0';
+      if (lValue < (lMin + lDigit) / 10) {
+        return false;
+      }
+      lValue = lValue * 10 - lDigit;
+    }
+    if (!lNegative) {
+      if (lValue == lMin) {
+        return false;
+      }
+      lValue = -lValue;
+    }
+    aResult = lValue;
+    return true;
+  }
+
+  static void encodeBoolean(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    aValue.m_type = opencsx::DT_BOOLEAN;
+    aValue.m_value.f_bool = aItem.getBooleanValue();
+  }
+
+  static void encodeByte(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    aValue.m_type = opencsx::DT_BYTE;
+    aValue.m_value.f_char = (unsigned char)(signed char)aItem.getIntValue();
+  }
+
+  static void encodeInt(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    aValue.m_type = opencsx::DT_INT;
+    aValue.m_value.f_int = aItem.getIntValue();
+  }
+
+  // xs:unsignedByte and xs:unsignedShort
+  static void encodeSmallUnsigned(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    aValue.m_type = opencsx::DT_INT;
+    aValue.m_value.f_int = (int32_t)aItem.getUnsignedIntValue();
+  }
+
+  static void encodeUnsignedInt(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    aValue.m_type = opencsx::DT_LONG;
+    aValue.m_value.f_long = aItem.getUnsignedIntValue();
+  }
+
+  static void encodeLong(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    aValue.m_type = opencsx::DT_LONG;
+    aValue.m_value.f_long = aItem.getLongValue();
+  }
+
+  // Unbounded; only values outside the 64-bit range stay lexical
+  static void encodeInteger(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    String lLexical = aItem.getStringValue();
+    if (integerFitsLong(lLexical, aValue.m_value.f_long)) {
+      aValue.m_type = opencsx::DT_LONG;
+    }
+    else {
+      aValue.m_type = opencsx::DT_STRING;
+      aValue.m_string.assign(lLexical.data(), lLexical.size());
+    }
+  }
+
+  static void encodeFloat(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    aValue.m_type = opencsx::DT_FLOAT;
+    aValue.m_value.f_float = (float)aItem.getDoubleValue();
+  }
+
+  static void encodeDouble(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    aValue.m_type = opencsx::DT_DOUBLE;
+    aValue.m_value.f_double = aItem.getDoubleValue();
+  }
+
+  // xs:decimal and the date/time types have no lossless native form
+  static void encodeLexical(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    String lLexical = aItem.getStringValue();
+    aValue.m_type = opencsx::DT_STRING;
+    aValue.m_string.assign(lLexical.data(), lLexical.size());
+  }
+
+  // Filled in before main(), so lookups need no lock
+  static class ValueEncoders {
+    public:
+      ValueEncoders()
+      {
+        for (size_t i = 0; i < store::XS_LAST; ++i) {
+          theEncoders[i] = &encodeLexical;
+        }
+        theEncoders[store::XS_BOOLEAN] = &encodeBoolean;
+        theEncoders[store::XS_BYTE] = &encodeByte;
+        theEncoders[store::XS_SHORT] = &encodeInt;
+        theEncoders[store::XS_INT] = &encodeInt;
+        theEncoders[store::XS_UNSIGNED_BYTE] = &encodeSmallUnsigned;
+        theEncoders[store::XS_UNSIGNED_SHORT] = &encodeSmallUnsigned;
+        theEncoders[store::XS_UNSIGNED_INT] = &encodeUnsignedInt;
+        theEncoders[store::XS_LONG] = &encodeLong;
+        theEncoders[store::XS_INTEGER] = &encodeInteger;
+        theEncoders[store::XS_NON_POSITIVE_INTEGER] = &encodeInteger;
+        theEncoders[store::XS_NEGATIVE_INTEGER] = &encodeInteger;
+        theEncoders[store::XS_NON_NEGATIVE_INTEGER] = &encodeInteger;
+        theEncoders[store::XS_POSITIVE_INTEGER] = &encodeInteger;
+        theEncoders[store::XS_UNSIGNED_LONG] = &encodeInteger;
+        theEncoders[store::XS_FLOAT] = &encodeFloat;
+        theEncoders[store::XS_DOUBLE] = &encodeDouble;
+      }
+
+      ValueEncoder get(store::SchemaTypeCode aType) const
+      {
+        return (size_t)aType < store::XS_LAST ? theEncoders[aType] : &encodeLexical;
+      }
+
+    private:
+      ValueEncoder theEncoders[store::XS_LAST];
+  } theValueEncoders;
+
+  ValueEncoder getValueEncoder(store::SchemaTypeCode aType)
+  {
+    return theValueEncoders.get(aType);
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  static Item createBoolean(ItemFactory* aFactory, const opencsx::AtomicValue& aValue)
+  {
+    return aFactory->createBoolean(aValue.m_value.f_bool);
+  }
+
+  static Item createByte(ItemFactory* aFactory, const opencsx::AtomicValue& aValue)
+  {
+    return aFactory->createByte((signed char)aValue.m_value.f_char);
+  }
+
+  static Item createInt(ItemFactory* aFactory, const opencsx::AtomicValue& aValue)
+  {
+    return aFactory->createInt(aValue.m_value.f_int);
+  }
+
+  static Item createLong(ItemFactory* aFactory, const opencsx::AtomicValue& aValue)
+  {
+    return aFactory->createLong(aValue.m_value.f_long);
+  }
+
+  static Item createFloat(ItemFactory* aFactory, const opencsx::AtomicValue& aValue)
+  {
+    return aFactory->createFloat(aValue.m_value.f_float);
+  }
+
+  static Item createDouble(ItemFactory* aFactory, const opencsx::AtomicValue& aValue)
+  {
+    return aFactory->createDouble(aValue.m_value.f_double);
+  }
+
+  static Item createUntypedAtomic(ItemFactory* aFactory, const opencsx::AtomicValue& aValue)
+  {
+    return aFactory->createUntypedAtomic(aValue.m_string);
+  }
+
+  static Item createTypeName(const char* aLocalName)
+  {
+    return Zorba::getInstance(0)->getItemFactory()->createQName(
+          zorba::String("http://www.w3.org/2001/XMLSchema"), zorba::String(aLocalName));
+  }
+
+  static Mutex theDecodePlanMutex;
+  static DecodePlan* theDecodePlan = 0;
+
+  const DecodePlan& DecodePlan::get()
+  {
+    ScopedLock lLock(theDecodePlanMutex);
+    if (!theDecodePlan) {
+      theDecodePlan = new DecodePlan();
+    }
+    return *theDecodePlan;
+  }
+
+  DecodePlan::DecodePlan()
+  {
+    theDefault.theType = createTypeName("untypedAtomic");
+    theDefault.theCreate = &createUntypedAtomic;
+    add(opencsx::DT_BOOLEAN, "boolean", &createBoolean);
+    add(opencsx::DT_BYTE, "byte", &createByte);
+    add(opencsx::DT_INT, "int", &createInt);
+    add(opencsx::DT_LONG, "long", &createLong);
+    add(opencsx::DT_FLOAT, "float", &createFloat);
+    add(opencsx::DT_DOUBLE, "double", &createDouble);
+  }
+
+  void DecodePlan::add(opencsx::DataType aType, const char* aTypeName, Constructor aCreate)
+  {
+    size_t lIndex = (size_t)aType;
+    if (theKinds.size() <= lIndex) {
+      theKinds.resize(lIndex + 1, theDefault);
+    }
+    theKinds[lIndex].theType = createTypeName(aTypeName);
+    theKinds[lIndex].theCreate = aCreate;
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
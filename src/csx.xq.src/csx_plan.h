@@ -0,0 +1,68 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_PLAN_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_PLAN_H__
+
+#include <zorba/zorba.h>
+#include <zorba/item_factory.h>
+#include <zorba/store_consts.h>
+#include <opencsx/csxhandler.h>
+#include <vector>
+
+namespace zorba { namespace csx {
+
+  // Writes an atomic item as an OpenCSX value
+  typedef void (*ValueEncoder)(const Item& aItem, opencsx::AtomicValue& aValue);
+
+  // The encoder for items of aType. OpenCSX only knows booleans, signed
+  // integers of 8, 32 and 64 bits, floats and doubles; every type derived
+  // from one of those (or whose values fit) is written natively, everything
+  // else in lexical form.
+  ValueEncoder getValueEncoder(store::SchemaTypeCode aType);
+
+  inline void encodeValue(const Item& aItem, opencsx::AtomicValue& aValue)
+  {
+    getValueEncoder(aItem.getTypeCode())(aItem, aValue);
+  }
+
+  /**
+   * A dispatch table from each OpenCSX DataType to the xs: type nodes
+   * holding its values are annotated with and the constructor of the
+   * atomic item, so the parser handler looks both up instead of switching
+   * on every value. The table depends on the DataType alone, not on any
+   * vocabulary, so all parses share one. It is built on first use, since
+   * its type names are items and need Zorba, and never freed.
+   */
+  class DecodePlan {
+    public:
+      typedef Item (*Constructor)(ItemFactory* aFactory, const opencsx::AtomicValue& aValue);
+
+      struct ValueKind {
+        Item theType;
+        Constructor theCreate;
+      };
+
+      static const DecodePlan& get();
+
+      // DT_ANYATOMIC, DT_STRING and types this build does not know become
+      // xs:untypedAtomic. DT_STRING holds every type without a native
+      // form (xs:decimal, dates, unvalidated values), so xs:string would
+      // be wrong for most of them.
+      const ValueKind& getKind(opencsx::DataType aType) const
+      {
+        size_t lIndex = (size_t)aType;
+        return lIndex < theKinds.size() ? theKinds[lIndex] : theDefault;
+      }
+
+    private:
+      DecodePlan();
+      DecodePlan(const DecodePlan&);
+      DecodePlan& operator=(const DecodePlan&);
+
+      void add(opencsx::DataType aType, const char* aTypeName, Constructor aCreate);
+
+      std::vector<ValueKind> theKinds;    // indexed by DataType
+      ValueKind theDefault;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_PLAN_H__
@@ -0,0 +1,159 @@
+#include "csx_pool.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  ProcessorPool::ProcessorPool(size_t aMaxIdle)
+    : theStreamThreshold(0)
+  {
+    theStats.theMaxIdle = aMaxIdle;
+    theStats.theIdle = 0;
+    theStats.theLive = 0;
+    theStats.theHits = 0;
+    theStats.theMisses = 0;
+    theStats.theCreated = 0;
+    theStats.theDiscarded = 0;
+  }
+
+  ProcessorPool::~ProcessorPool()
+  {
+    for (vector<VocabProcessor*>::iterator ite = theIdle.begin(); ite != theIdle.end(); ++ite) {
+      delete *ite;
+    }
+  }
+
+  VocabProcessor* ProcessorPool::checkout(const vector<String>& aVocabs)
+  {
+    VocabProcessor* lProcessor = 0;
+    VocabProcessor* lDiscard = 0;
+    {
+      ScopedLock lLock(theMutex);
+      // Most recently returned first; prefer one that holds aVocabs already
+      for (size_t i = theIdle.size(); i > 0; --i) {
+        if (theIdle[i - 1]->holds(aVocabs)) {
+          lProcessor = theIdle[i - 1];
+          theIdle.erase(theIdle.begin() + (i - 1));
+          ++theStats.theHits;
+          break;
+        }
+      }
+      if (!lProcessor) {
+        // OpenCSX cannot unload vocabularies, so an idle processor holding
+        // others would encode with names the caller never asked for. Start
+        // a new one, and make room for it by dropping the oldest idle one.
+        ++theStats.theMisses;
+        ++theStats.theCreated;
+        ++theStats.theLive;
+        if (!theIdle.empty() && theIdle.size() >= theStats.theMaxIdle) {
+          lDiscard = theIdle.front();
+          theIdle.erase(theIdle.begin());
+          ++theStats.theDiscarded;
+          --theStats.theLive;
+        }
+      }
+    }
+
+    delete lDiscard;
+    if (!lProcessor) {
+      lProcessor = new VocabProcessor();
+    }
+    try {
+      lProcessor->loadVocabs(aVocabs);
+    }
+    catch (...) {
+      discard(lProcessor);
+      throw;
+    }
+    return lProcessor;
+  }
+
+  void ProcessorPool::checkin(VocabProcessor* aProcessor)
+  {
+    {
+      ScopedLock lLock(theMutex);
+      theCounters.add(aProcessor->getCounters());
+      aProcessor->getCounters().reset();
+      if (theIdle.size() < theStats.theMaxIdle) {
+        theIdle.push_back(aProcessor);
+        return;
+      }
+      ++theStats.theDiscarded;
+      --theStats.theLive;
+    }
+    delete aProcessor;
+  }
+
+  void ProcessorPool::discard(VocabProcessor* aProcessor)
+  {
+    {
+      ScopedLock lLock(theMutex);
+      theCounters.add(aProcessor->getCounters());
+      ++theStats.theDiscarded;
+      --theStats.theLive;
+    }
+    delete aProcessor;
+  }
+
+  size_t ProcessorPool::setMaxIdle(size_t aMaxIdle)
+  {
+    vector<VocabProcessor*> lDiscard;
+    size_t lPrevious;
+    {
+      ScopedLock lLock(theMutex);
+      lPrevious = theStats.theMaxIdle;
+      theStats.theMaxIdle = aMaxIdle;
+      while (theIdle.size() > aMaxIdle) {
+        lDiscard.push_back(theIdle.front());
+        theIdle.erase(theIdle.begin());
+        ++theStats.theDiscarded;
+        --theStats.theLive;
+      }
+    }
+    for (vector<VocabProcessor*>::iterator ite = lDiscard.begin(); ite != lDiscard.end(); ++ite) {
+      delete *ite;
+    }
+    return lPrevious;
+  }
+
+  size_t ProcessorPool::setStreamThreshold(size_t aBytes)
+  {
+    ScopedLock lLock(theMutex);
+    size_t lPrevious = theStreamThreshold;
+    theStreamThreshold = aBytes;
+    return lPrevious;
+  }
+
+  size_t ProcessorPool::getStreamThreshold()
+  {
+    ScopedLock lLock(theMutex);
+    return theStreamThreshold;
+  }
+
+  ProcessorPool::Stats ProcessorPool::getStats()
+  {
+    ScopedLock lLock(theMutex);
+    Stats lStats = theStats;
+    lStats.theIdle = theIdle.size();
+    return lStats;
+  }
+
+  Counters ProcessorPool::getCounters()
+  {
+    ScopedLock lLock(theMutex);
+    return theCounters;
+  }
+
+  void ProcessorPool::addCounters(const Counters& aCounters)
+  {
+    ScopedLock lLock(theMutex);
+    theCounters.add(aCounters);
+  }
+
+  void ProcessorPool::resetCounters()
+  {
+    ScopedLock lLock(theMutex);
+    theCounters.reset();
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
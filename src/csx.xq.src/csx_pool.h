@@ -0,0 +1,102 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_POOL_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_POOL_H__
+
+#include <zorba/zorba.h>
+#include <exception>
+#include <vector>
+#include <stdint.h>
+
+#include "csx_sync.h"
+#include "csx_vocab.h"
+
+namespace zorba { namespace csx {
+
+  /**
+   * Pool of VocabProcessors shared by all CSX functions. A processor is
+   * checked out for the duration of one parse or serialize, so concurrent
+   * queries never share one. Checkout never blocks: if nothing suitable is
+   * idle a new processor is created. At most theMaxIdle processors are kept
+   * around once they are returned.
+   */
+  class ProcessorPool {
+    public:
+      struct Stats {
+        size_t theMaxIdle;
+        size_t theIdle;
+        size_t theLive;
+        uint64_t theHits;     // idle processor already held the vocabularies
+        uint64_t theMisses;   // processor had to (re)load vocabularies
+        uint64_t theCreated;
+        uint64_t theDiscarded;
+      };
+
+      ProcessorPool(size_t aMaxIdle);
+      ~ProcessorPool();
+
+      // Returns a processor with the current versions of aVocabs loaded.
+      VocabProcessor* checkout(const std::vector<String>& aVocabs);
+      void checkin(VocabProcessor* aProcessor);
+      // Like checkin(), but never reuses aProcessor: for those that OpenCSX
+      // left by an exception, which it does not promise to survive
+      void discard(VocabProcessor* aProcessor);
+
+      // Returns the previous limit.
+      size_t setMaxIdle(size_t aMaxIdle);
+
+      // String values of at least this many bytes are spilled to temporary
+      // files when parsed; 0 keeps all of them in memory. Returns the
+      // previous threshold.
+      size_t setStreamThreshold(size_t aBytes);
+      size_t getStreamThreshold();
+
+      Stats getStats();
+
+      // Counters of all processors, as of their last checkin
+      Counters getCounters();
+      void addCounters(const Counters& aCounters);
+      void resetCounters();
+
+    private:
+      ProcessorPool(const ProcessorPool&);
+      ProcessorPool& operator=(const ProcessorPool&);
+
+      Mutex theMutex;
+      std::vector<VocabProcessor*> theIdle;
+      Stats theStats;
+      Counters theCounters;
+      size_t theStreamThreshold;
+  };
+
+  /**
+   * Checks a processor out of a pool and returns it on destruction, or
+   * discards it if it is destroyed by an exception.
+   */
+  class PooledProcessor {
+    public:
+      PooledProcessor(ProcessorPool& aPool, const std::vector<String>& aVocabs)
+        : thePool(aPool), theProcessor(aPool.checkout(aVocabs)) {}
+
+      ~PooledProcessor()
+      {
+        if (std::uncaught_exception()) {
+          thePool.discard(theProcessor);
+        }
+        else {
+          thePool.checkin(theProcessor);
+        }
+      }
+
+      VocabProcessor* operator->() const { return theProcessor; }
+      VocabProcessor* get() const { return theProcessor; }
+
+    private:
+      PooledProcessor(const PooledProcessor&);
+      PooledProcessor& operator=(const PooledProcessor&);
+
+      ProcessorPool& thePool;
+      VocabProcessor* theProcessor;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_POOL_H__
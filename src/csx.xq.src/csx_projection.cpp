@@ -0,0 +1,105 @@
+#include "csx.h"
+#include "csx_projection.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  Projection::Projection(const vector<String>& aPaths)
+    : theHasFloating(false),
+      theDepth(0)
+  {
+    thePaths.resize(aPaths.size());
+    for (size_t i = 0; i < aPaths.size(); ++i) {
+      parsePath(aPaths[i].str(), thePaths[i]);
+      if (!thePaths[i].theAnchored) {
+        theHasFloating = true;
+      }
+    }
+  }
+
+  void Projection::parsePath(const string& aPath, Path& aResult)
+  {
+    size_t lPos = 0;
+    aResult.theAnchored = false;
+    if (aPath.compare(0, 2, "//") == 0) {
+      lPos = 2;
+    }
+    else if (aPath.compare(0, 1, "/") == 0) {
+      aResult.theAnchored = true;
+      lPos = 1;
+    }
+
+    while (lPos <= aPath.size()) {
+      Step lStep;
+      lStep.theAnyUri = true;
+      if (aPath.compare(lPos, 2, "Q{") == 0) {
+        size_t lEnd = aPath.find('}', lPos + 2);
+        if (lEnd == string::npos) {
+          CSXModule::raiseError("CSX0004", "unterminated Q{ in projection path " + aPath);
+        }
+        lStep.theUri = aPath.substr(lPos + 2, lEnd - lPos - 2);
+        lStep.theAnyUri = false;
+        lPos = lEnd + 1;
+      }
+      size_t lEnd = aPath.find('/', lPos);
+      if (lEnd == string::npos) {
+        lEnd = aPath.size();
+      }
+      lStep.theLocalName = aPath.substr(lPos, lEnd - lPos);
+      if (lStep.theLocalName.empty()) {
+        CSXModule::raiseError("CSX0004", "empty step in projection path " + aPath);
+      }
+      lStep.theAnyLocalName = (lStep.theLocalName == "*");
+      aResult.theSteps.push_back(lStep);
+      lPos = lEnd + 1;
+    }
+  }
+
+  Projection::Match Projection::enter(const string& aUri, const string& aLocalName)
+  {
+    if (theLevels.size() <= theDepth) {
+      theLevels.resize(theDepth + 1);
+    }
+    vector<State>& lStates = theLevels[theDepth];
+    lStates.clear();
+
+    // Candidates: continuations of the parent's partial matches, anchored
+    // paths at the top level, and floating paths everywhere
+    size_t lParentCount = theDepth > 0 ? theLevels[theDepth - 1].size() : 0;
+    for (size_t i = 0; i < lParentCount + thePaths.size(); ++i) {
+      State lState;
+      if (i < lParentCount) {
+        lState = theLevels[theDepth - 1][i];
+      }
+      else {
+        size_t lPath = i - lParentCount;
+        if (thePaths[lPath].theAnchored && theDepth > 0) {
+          continue;
+        }
+        lState = State(lPath, 0);
+      }
+
+      const Path& lPath = thePaths[lState.first];
+      if (!lPath.theSteps[lState.second].matches(aUri, aLocalName)) {
+        continue;
+      }
+      if (lState.second + 1 == lPath.theSteps.size()) {
+        return KEEP;
+      }
+      lStates.push_back(State(lState.first, lState.second + 1));
+    }
+
+    if (lStates.empty() && !theHasFloating) {
+      return SKIP;
+    }
+    ++theDepth;
+    return ANCESTOR;
+  }
+
+  void Projection::leave()
+  {
+    --theDepth;
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
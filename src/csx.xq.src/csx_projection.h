@@ -0,0 +1,68 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_PROJECTION_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_PROJECTION_H__
+
+#include <zorba/zorba.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace zorba { namespace csx {
+
+  /**
+   * The set of element paths csx:parse() should materialize. A path is a
+   * list of steps separated by '/'; with a leading '/' it is matched from
+   * the top-level elements, otherwise at any depth. A step is a local name
+   * (any namespace), Q{uri}local, or '*'.
+   *
+   * The parser reports every element it would open with enter() and every
+   * element it closes with leave(), except within subtrees for which
+   * enter() returned KEEP or SKIP.
+   */
+  class Projection {
+    public:
+      enum Match {
+        SKIP,       // nothing in this subtree is kept
+        ANCESTOR,   // something below might be kept
+        KEEP        // keep the whole subtree
+      };
+
+      // Raises csx:CSX0004 for a malformed path
+      Projection(const std::vector<String>& aPaths);
+
+      Match enter(const std::string& aUri, const std::string& aLocalName);
+      void leave();
+
+    private:
+      struct Step {
+        std::string theUri;
+        std::string theLocalName;
+        bool theAnyUri;
+        bool theAnyLocalName;
+
+        bool matches(const std::string& aUri, const std::string& aLocalName) const {
+          return (theAnyLocalName || theLocalName == aLocalName) &&
+                 (theAnyUri || theUri == aUri);
+        }
+      };
+
+      struct Path {
+        std::vector<Step> theSteps;
+        bool theAnchored;
+      };
+
+      // (path, number of steps matched so far)
+      typedef std::pair<size_t, size_t> State;
+
+      static void parsePath(const std::string& aPath, Path& aResult);
+
+      std::vector<Path> thePaths;
+      bool theHasFloating;
+
+      // Active states per open ANCESTOR level; the vectors are reused
+      std::vector<std::vector<State> > theLevels;
+      size_t theDepth;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_PROJECTION_H__
@@ -0,0 +1,24 @@
+#include "csx_scratch.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  ParseScratch::ParseScratch()
+  {
+    ItemFactory* lFactory = Zorba::getInstance(0)->getItemFactory();
+    zorba::String xs("http://www.w3.org/2001/XMLSchema");
+    theUntypedType = lFactory->createQName(xs, zorba::String("untyped"));
+    theAnyAtomicType = lFactory->createQName(xs, zorba::String("AnyAtomicType"));
+    theAnyType = lFactory->createQName(xs, zorba::String("anyType"));
+  }
+
+  void ParseScratch::clear()
+  {
+    // Nodes must not outlive the parse that built them in here
+    theElements.clear();
+    theAtomics.clear();
+    theDeferredAttrs.clear();
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
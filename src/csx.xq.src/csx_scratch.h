@@ -0,0 +1,62 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_SCRATCH_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_SCRATCH_H__
+
+#include <zorba/zorba.h>
+#include <zorba/item_factory.h>
+#include <opencsx/csxhandler.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace zorba { namespace csx {
+
+  /**
+   * The working storage of CSXParserHandler, kept from one parse to the
+   * next. It belongs to one VocabProcessor, like its NameCache, so a
+   * handler built for a call starts with stacks and pending-element slots
+   * that have already grown to the size of earlier streams, and with the
+   * type names already created. clear() drops the items but none of the
+   * capacity.
+   */
+  class ParseScratch {
+    public:
+      // An open ancestor of possibly kept elements (see Projection); its
+      // strings are assigned into, so a reused slot rarely allocates
+      struct PendingElement {
+        std::string theUri;
+        std::string theLocalName;
+        std::string thePrefix;
+        opencsx::CSXHandler::NsBindings theBindings;
+        bool theBuilt;
+      };
+
+      // An attribute of an element whose type is not known yet, with the
+      // type of its value
+      struct DeferredAttribute {
+        Item theName;
+        Item theValue;
+        Item theType;
+      };
+
+      ParseScratch();
+
+      void clear();
+
+      std::vector<Item> theElements;
+      std::vector<Item> theAtomics;
+      std::vector<PendingElement> thePending;
+      std::vector<DeferredAttribute> theDeferredAttrs;
+
+      // xs: type names
+      Item theUntypedType;
+      Item theAnyAtomicType;
+      Item theAnyType;
+
+    private:
+      ParseScratch(const ParseScratch&);
+      ParseScratch& operator=(const ParseScratch&);
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_SCRATCH_H__
@@ -0,0 +1,65 @@
+#ifdef WIN32
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
+#include "csx_stats.h"
+
+namespace zorba { namespace csx {
+
+  void Counters::reset()
+  {
+    theElements = 0;
+    theAttributes = 0;
+    theAtomics = 0;
+    theTextBytes = 0;
+    theInputBytes = 0;
+    theOutputBytes = 0;
+    theVocabularyLoads = 0;
+    theSpilledBytes = 0;
+    theNameHits = 0;
+    theNameMisses = 0;
+    theVocabularyTime = 0;
+    theEncodeTime = 0;
+    theDecodeTime = 0;
+    theIOTime = 0;
+  }
+
+  void Counters::add(const Counters& aOther)
+  {
+    theElements += aOther.theElements;
+    theAttributes += aOther.theAttributes;
+    theAtomics += aOther.theAtomics;
+    theTextBytes += aOther.theTextBytes;
+    theInputBytes += aOther.theInputBytes;
+    theOutputBytes += aOther.theOutputBytes;
+    theVocabularyLoads += aOther.theVocabularyLoads;
+    theSpilledBytes += aOther.theSpilledBytes;
+    theNameHits += aOther.theNameHits;
+    theNameMisses += aOther.theNameMisses;
+    theVocabularyTime += aOther.theVocabularyTime;
+    theEncodeTime += aOther.theEncodeTime;
+    theDecodeTime += aOther.theDecodeTime;
+    theIOTime += aOther.theIOTime;
+  }
+
+  uint64_t monotonicMicros()
+  {
+#ifdef WIN32
+    static LARGE_INTEGER sFrequency;
+    if (sFrequency.QuadPart == 0) {
+      QueryPerformanceFrequency(&sFrequency);
+    }
+    LARGE_INTEGER lNow;
+    QueryPerformanceCounter(&lNow);
+    return (uint64_t)(lNow.QuadPart / sFrequency.QuadPart) * 1000000 +
+      (uint64_t)(lNow.QuadPart % sFrequency.QuadPart) * 1000000 / sFrequency.QuadPart;
+#else
+    struct timespec lNow;
+    clock_gettime(CLOCK_MONOTONIC, &lNow);
+    return (uint64_t)lNow.tv_sec * 1000000 + lNow.tv_nsec / 1000;
+#endif
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
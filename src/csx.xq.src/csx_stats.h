@@ -0,0 +1,58 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_STATS_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_STATS_H__
+
+#include <stdint.h>
+
+namespace zorba { namespace csx {
+
+  /**
+   * Work done by parses and serializations, and where the time went (in
+   * microseconds). Every VocabProcessor has its own counters, updated
+   * without locking by whoever has it checked out; the ProcessorPool adds
+   * them to the module totals when the processor is checked in.
+   */
+  struct Counters {
+    Counters() { reset(); }
+
+    void reset();
+    void add(const Counters& aOther);
+
+    uint64_t theElements;
+    uint64_t theAttributes;
+    uint64_t theAtomics;
+    uint64_t theTextBytes;
+    uint64_t theInputBytes;        // CSX bytes parsed
+    uint64_t theOutputBytes;       // CSX bytes written
+    uint64_t theVocabularyLoads;
+    uint64_t theSpilledBytes;      // string values moved to temporary files
+    uint64_t theNameHits;          // QNames and bindings found interned
+    uint64_t theNameMisses;        // ... and created
+
+    uint64_t theVocabularyTime;
+    uint64_t theEncodeTime;        // walking the XDM and encoding it
+    uint64_t theDecodeTime;        // decoding and building the XDM
+    uint64_t theIOTime;            // opening, mapping, flushing files
+  };
+
+  // Microseconds since some fixed point in the past
+  uint64_t monotonicMicros();
+
+  /**
+   * Adds the time between construction and destruction to a counter.
+   */
+  class PhaseTimer {
+    public:
+      PhaseTimer(uint64_t& aTarget) : theTarget(aTarget), theStart(monotonicMicros()) {}
+      ~PhaseTimer() { theTarget += monotonicMicros() - theStart; }
+
+    private:
+      PhaseTimer(const PhaseTimer&);
+      PhaseTimer& operator=(const PhaseTimer&);
+
+      uint64_t& theTarget;
+      uint64_t theStart;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_STATS_H__
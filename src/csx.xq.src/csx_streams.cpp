@@ -0,0 +1,350 @@
+#include <zorba/base64.h>
+
+#include <string.h>
+#include <limits.h>
+#ifdef WIN32
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include "csx.h"
+#include "csx_streams.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  OutputBuffer::OutputBuffer(size_t aInitialSize)
+    : theBuffer(aInitialSize > 0 ? aInitialSize : 1)
+  {
+    setp(&theBuffer[0], &theBuffer[0] + theBuffer.size());
+  }
+
+  void OutputBuffer::grow(size_t aMinFree)
+  {
+    size_t lUsed = size();
+    size_t lNewSize = theBuffer.size() * 2;
+    if (lNewSize < lUsed + aMinFree) {
+      lNewSize = lUsed + aMinFree;
+    }
+    theBuffer.resize(lNewSize);
+    setp(&theBuffer[0], &theBuffer[0] + lNewSize);
+    while (lUsed > 0) {
+      int lStep = lUsed > (size_t)INT_MAX ? INT_MAX : (int)lUsed;
+      pbump(lStep);
+      lUsed -= lStep;
+    }
+  }
+
+  OutputBuffer::int_type OutputBuffer::overflow(int_type c)
+  {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+      return traits_type::not_eof(c);
+    }
+    grow(1);
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+  }
+
+  streamsize OutputBuffer::xsputn(const char* s, streamsize n)
+  {
+    if (n <= 0) {
+      return 0;
+    }
+    if (epptr() - pptr() < n) {
+      grow((size_t)n);
+    }
+    memcpy(pptr(), s, (size_t)n);
+    streamsize lLeft = n;
+    while (lLeft > 0) {
+      int lStep = lLeft > INT_MAX ? INT_MAX : (int)lLeft;
+      pbump(lStep);
+      lLeft -= lStep;
+    }
+    return n;
+  }
+
+  OutputBuffer::pos_type
+  OutputBuffer::seekoff(off_type off, ios_base::seekdir dir, ios_base::openmode which)
+  {
+    if (off != 0 || dir != ios_base::cur || !(which & ios_base::out)) {
+      return pos_type(off_type(-1));
+    }
+    return pos_type(off_type(size()));
+  }
+
+  void OutputBuffer::release(vector<char>& aTarget)
+  {
+    theBuffer.resize(size());
+    aTarget.swap(theBuffer);
+    vector<char>(1).swap(theBuffer);
+    setp(&theBuffer[0], &theBuffer[0] + theBuffer.size());
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  void MemoryInputBuffer::reset(const char* aData, size_t aSize)
+  {
+    char* lData = const_cast<char*>(aData);
+    setg(lData, lData, lData + aSize);
+  }
+
+  MemoryInputBuffer::pos_type
+  MemoryInputBuffer::seekoff(off_type off, ios_base::seekdir dir,
+                             ios_base::openmode which)
+  {
+    if (!(which & ios_base::in)) {
+      return pos_type(off_type(-1));
+    }
+    off_type lTarget = off;
+    if (dir == ios_base::cur) {
+      lTarget += gptr() - eback();
+    } else if (dir == ios_base::end) {
+      lTarget += egptr() - eback();
+    }
+    if (lTarget < 0 || lTarget > egptr() - eback()) {
+      return pos_type(off_type(-1));
+    }
+    setg(eback(), eback() + lTarget, egptr());
+    return pos_type(lTarget);
+  }
+
+  MemoryInputBuffer::pos_type
+  MemoryInputBuffer::seekpos(pos_type pos, ios_base::openmode which)
+  {
+    return seekoff(off_type(pos), ios_base::beg, which);
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  BufferInputStream::BufferInputStream(OutputBuffer& aSource)
+    : std::istream(0)
+  {
+    aSource.release(theData);
+    theBuffer.reset(theData.empty() ? 0 : &theData[0], theData.size());
+    rdbuf(&theBuffer);
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  SpillFileStream* SpillFileStream::create(const string& aData)
+  {
+    // tmpfile() files have no name and vanish on fclose() or exit
+    FILE* lFile = tmpfile();
+    if (!lFile) {
+      return 0;
+    }
+    if (fwrite(aData.data(), 1, aData.size(), lFile) != aData.size() ||
+        fflush(lFile) != 0 || fseek(lFile, 0, SEEK_SET) != 0) {
+      fclose(lFile);
+      return 0;
+    }
+    return new SpillFileStream(lFile);
+  }
+
+  SpillFileStream::SpillFileStream(FILE* aFile)
+    : std::istream(0),
+      theFile(aFile),
+      theBuffer(aFile)
+  {
+    rdbuf(&theBuffer);
+  }
+
+  SpillFileStream::~SpillFileStream()
+  {
+    fclose(theFile);
+  }
+
+  SpillFileStream::FileBuffer::int_type SpillFileStream::FileBuffer::underflow()
+  {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    size_t lRead = fread(&theBuffer[0], 1, theBuffer.size(), theFile);
+    if (lRead == 0) {
+      return traits_type::eof();
+    }
+    setg(&theBuffer[0], &theBuffer[0], &theBuffer[0] + lRead);
+    return traits_type::to_int_type(*gptr());
+  }
+
+  SpillFileStream::FileBuffer::pos_type
+  SpillFileStream::FileBuffer::seekoff(off_type off, ios_base::seekdir dir,
+                                       ios_base::openmode which)
+  {
+    if (!(which & ios_base::in)) {
+      return pos_type(off_type(-1));
+    }
+    // The file position is past what is still buffered
+    if (dir == ios_base::cur) {
+      off -= egptr() - gptr();
+    }
+    int lWhence = dir == ios_base::beg ? SEEK_SET : dir == ios_base::cur ? SEEK_CUR : SEEK_END;
+    if (fseek(theFile, (long)off, lWhence) != 0) {
+      return pos_type(off_type(-1));
+    }
+    setg(0, 0, 0);
+    return pos_type(off_type(ftell(theFile)));
+  }
+
+  SpillFileStream::FileBuffer::pos_type
+  SpillFileStream::FileBuffer::seekpos(pos_type pos, ios_base::openmode which)
+  {
+    return seekoff(off_type(pos), ios_base::beg, which);
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  void getBinaryBytes(Item& aItem, string& aCopy, const char*& aData, size_t& aSize)
+  {
+    if (aItem.isStreamable()) {
+      istream& lStream = aItem.getStream();
+      BufferInputStream* lOwn = dynamic_cast<BufferInputStream*>(&lStream);
+      if (lOwn) {
+        aData = lOwn->data();
+        aSize = lOwn->size();
+      }
+      else {
+        bool lSeekable = aItem.isSeekable();
+        istream::pos_type lPosition(0);
+        if (lSeekable) {
+          lStream.clear();
+          lPosition = lStream.tellg();
+          lStream.seekg(0);
+        }
+        char lBuffer[64 * 1024];
+        while (lStream.read(lBuffer, sizeof(lBuffer)) || lStream.gcount() > 0) {
+          aCopy.append(lBuffer, (size_t)lStream.gcount());
+        }
+        if (lSeekable) {
+          lStream.clear();
+          lStream.seekg(lPosition);
+        }
+        aData = aCopy.data();
+        aSize = aCopy.size();
+      }
+    }
+    else {
+      aData = aItem.getBase64BinaryValue(aSize);
+    }
+    if (aItem.isEncoded()) {
+      zorba::String lEncoded(aData, aSize);
+      aCopy = zorba::encoding::Base64::decode(lEncoded).str();
+      aData = aCopy.data();
+      aSize = aCopy.size();
+    }
+  }
+
+  BinaryItemInput::BinaryItemInput(Item& aItem)
+    : theItem(aItem),
+      theStream(0)
+  {
+    const char* lData;
+    size_t lSize;
+    getBinaryBytes(theItem, theCopy, lData, lSize);
+    theBuffer.reset(lData, lSize);
+    theStream.rdbuf(&theBuffer);
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  MappedFile::MappedFile(const String& aPath)
+    : theData(0), theSize(0)
+  {
+#ifdef WIN32
+    theMapping = 0;
+    theFile = CreateFileA(aPath.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (theFile == INVALID_HANDLE_VALUE) {
+      CSXModule::raiseError("CSX0002", "cannot open " + aPath.str());
+    }
+    LARGE_INTEGER lSize;
+    GetFileSizeEx(theFile, &lSize);
+    theSize = (size_t)lSize.QuadPart;
+    if (theSize > 0) {
+      theMapping = CreateFileMappingA(theFile, 0, PAGE_READONLY, 0, 0, 0);
+      if (theMapping) {
+        theData = (const char*)MapViewOfFile(theMapping, FILE_MAP_READ, 0, 0, 0);
+      }
+      if (!theData) {
+        if (theMapping) {
+          CloseHandle(theMapping);
+        }
+        CloseHandle(theFile);
+        CSXModule::raiseError("CSX0002", "cannot map " + aPath.str());
+      }
+    }
+#else
+    int lFd = ::open(aPath.c_str(), O_RDONLY);
+    if (lFd < 0) {
+      CSXModule::raiseError("CSX0002", "cannot open " + aPath.str());
+    }
+    struct stat lStat;
+    if (fstat(lFd, &lStat) != 0) {
+      ::close(lFd);
+      CSXModule::raiseError("CSX0002", "cannot stat " + aPath.str());
+    }
+    theSize = (size_t)lStat.st_size;
+    if (theSize > 0) {
+      void* lData = mmap(0, theSize, PROT_READ, MAP_PRIVATE, lFd, 0);
+      if (lData == MAP_FAILED) {
+        ::close(lFd);
+        CSXModule::raiseError("CSX0002", "cannot map " + aPath.str());
+      }
+      // The parser reads front to back
+      madvise(lData, theSize, MADV_SEQUENTIAL);
+      theData = (const char*)lData;
+    }
+    // The mapping stays valid without the descriptor
+    ::close(lFd);
+#endif
+  }
+
+  MappedFile::~MappedFile()
+  {
+#ifdef WIN32
+    if (theData) {
+      UnmapViewOfFile(theData);
+      CloseHandle(theMapping);
+    }
+    CloseHandle(theFile);
+#else
+    if (theData) {
+      munmap(const_cast<char*>(theData), theSize);
+    }
+#endif
+  }
+
+  CSXInput* MappedFile::open()
+  {
+    return new MemoryInput(theData, theSize);
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  BufferedItemSource::BufferedItemSource(Item& aItem)
+    : theItem(aItem)
+  {
+    getBinaryBytes(theItem, theCopy, theData, theSize);
+  }
+
+  CSXInput* BufferedItemSource::open()
+  {
+    return new MemoryInput(theData, theSize);
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
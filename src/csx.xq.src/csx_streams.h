@@ -0,0 +1,221 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_STREAMS_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_STREAMS_H__
+
+#include <zorba/item.h>
+#include <istream>
+#include <streambuf>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace zorba { namespace csx {
+
+  /**
+   * A streambuf that writes into a growable in-memory buffer. The bytes can
+   * be handed off with release() without copying them.
+   */
+  class OutputBuffer : public std::streambuf {
+    public:
+      OutputBuffer(size_t aInitialSize = 64 * 1024);
+
+      const char* data() const { return &theBuffer[0]; }
+      size_t size() const { return pptr() - pbase(); }
+
+      // Moves the written bytes into aTarget and leaves this buffer empty.
+      void release(std::vector<char>& aTarget);
+
+    protected:
+      virtual int_type overflow(int_type c);
+      virtual std::streamsize xsputn(const char* s, std::streamsize n);
+      // Only reports the current position, for tellp()
+      virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                               std::ios_base::openmode which);
+
+    private:
+      void grow(size_t aMinFree);
+
+      std::vector<char> theBuffer;
+  };
+
+  /**
+   * A read-only, seekable streambuf over memory owned by someone else.
+   */
+  class MemoryInputBuffer : public std::streambuf {
+    public:
+      MemoryInputBuffer() { reset(0, 0); }
+      MemoryInputBuffer(const char* aData, size_t aSize) { reset(aData, aSize); }
+
+      void reset(const char* aData, size_t aSize);
+
+    protected:
+      virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                               std::ios_base::openmode which);
+      virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+  };
+
+  /**
+   * An istream that owns the bytes it reads from. Used to hand the result of
+   * an in-memory serialization to the ItemFactory as a streamable binary.
+   */
+  class BufferInputStream : public std::istream {
+    public:
+      BufferInputStream(OutputBuffer& aSource);
+
+      // The bytes, which readers can use without moving the stream
+      const char* data() const { return theData.empty() ? 0 : &theData[0]; }
+      size_t size() const { return theData.size(); }
+
+      // StreamReleaser for createStreamable*() items
+      static void release(std::istream* aStream) { delete aStream; }
+
+    private:
+      std::vector<char> theData;
+      MemoryInputBuffer theBuffer;
+  };
+
+  /**
+   * An istream over an anonymous temporary file, which is removed when the
+   * stream is deleted. Large values read from a CSX stream are moved out
+   * of memory this way and handed to the ItemFactory as streamable strings.
+   */
+  class SpillFileStream : public std::istream {
+    public:
+      // Returns null if no temporary file can be created or written
+      static SpillFileStream* create(const std::string& aData);
+
+      virtual ~SpillFileStream();
+
+      // StreamReleaser for createStreamable*() items
+      static void release(std::istream* aStream) { delete aStream; }
+
+    private:
+      class FileBuffer : public std::streambuf {
+        public:
+          FileBuffer(FILE* aFile) : theFile(aFile), theBuffer(64 * 1024) {}
+
+        protected:
+          virtual int_type underflow();
+          virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                                   std::ios_base::openmode which);
+          virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+
+        private:
+          FILE* theFile;
+          std::vector<char> theBuffer;
+      };
+
+      SpillFileStream(FILE* aFile);
+
+      FILE* theFile;
+      FileBuffer theBuffer;
+  };
+
+  /**
+   * An istream over CSX bytes, valid as long as this object lives.
+   */
+  class CSXInput {
+    public:
+      virtual ~CSXInput() {}
+      virtual std::istream& stream() = 0;
+  };
+
+  /**
+   * Something CSX can be read from, possibly more than once.
+   */
+  class CSXSource : public SmartObject {
+    public:
+      // The caller owns the result
+      virtual CSXInput* open() = 0;
+  };
+
+  typedef SmartPtr<CSXSource> CSXSource_t;
+
+  /**
+   * Points aData at the bytes of an xs:base64Binary item, copying or
+   * decoding them into aCopy if need be. The stream of a streamable item
+   * is shared by all its readers, one of which may be a lazy parse that is
+   * half-way through it. So the bytes behind the module's own
+   * BufferInputStreams are used where they are, and other streams are
+   * copied and put back where they were.
+   */
+  void getBinaryBytes(Item& aItem, std::string& aCopy, const char*& aData, size_t& aSize);
+
+  /**
+   * Gives an istream of its own over the bytes of an xs:base64Binary item.
+   * Raw items are read in place; see getBinaryBytes().
+   */
+  class BinaryItemInput : public CSXInput {
+    public:
+      BinaryItemInput(Item& aItem);
+
+      virtual std::istream& stream() { return theStream; }
+
+    private:
+      Item theItem;
+      std::string theCopy;
+      MemoryInputBuffer theBuffer;
+      std::istream theStream;
+  };
+
+  // Gets the bytes again for every input opened on it
+  class ItemSource : public CSXSource {
+    public:
+      ItemSource(const Item& aItem) : theItem(aItem) {}
+      virtual CSXInput* open() { return new BinaryItemInput(theItem); }
+    private:
+      Item theItem;
+  };
+
+  /**
+   * A file mapped read-only into memory.
+   */
+  class MappedFile : public CSXSource {
+    public:
+      // Raises csx:CSX0002 if the file cannot be opened or mapped
+      MappedFile(const String& aPath);
+      virtual ~MappedFile();
+
+      const char* data() const { return theData; }
+      size_t size() const { return theSize; }
+
+      // An input reading straight from the mapping
+      virtual CSXInput* open();
+
+    private:
+      const char* theData;
+      size_t theSize;
+#ifdef WIN32
+      void* theFile;
+      void* theMapping;
+#endif
+  };
+
+  /**
+   * The bytes of an xs:base64Binary item, read (and decoded, if need be)
+   * once. Unlike ItemSource, it never touches the item again, so inputs
+   * opened on it may be used from several threads at a time.
+   */
+  class BufferedItemSource : public CSXSource {
+    public:
+      BufferedItemSource(Item& aItem);
+      virtual CSXInput* open();
+    private:
+      Item theItem;
+      std::string theCopy;
+      const char* theData;
+      size_t theSize;
+  };
+
+  class MemoryInput : public CSXInput {
+    public:
+      MemoryInput(const char* aData, size_t aSize)
+        : theBuffer(aData, aSize), theStream(&theBuffer) {}
+      virtual std::istream& stream() { return theStream; }
+    private:
+      MemoryInputBuffer theBuffer;
+      std::istream theStream;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_STREAMS_H__
@@ -0,0 +1,97 @@
+#include <zorba/zorba_exception.h>
+
+#include <exception>
+#include <vector>
+
+#include "csx_sync.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  namespace {
+
+    // Shared by the threads of one parallelFor() call
+    struct WorkState {
+      ParallelTask* theTask;
+      size_t theCount;
+      Mutex theMutex;
+      size_t theNext;
+      string theError;
+
+      bool take(size_t& aIndex) {
+        ScopedLock lLock(theMutex);
+        if (theNext >= theCount || !theError.empty()) {
+          return false;
+        }
+        aIndex = theNext++;
+        return true;
+      }
+
+      void fail(const char* aMessage) {
+        ScopedLock lLock(theMutex);
+        if (theError.empty()) {
+          theError = (aMessage && *aMessage) ? aMessage : "unknown error";
+        }
+      }
+
+      void work() {
+        size_t lIndex;
+        while (take(lIndex)) {
+          try {
+            theTask->run(lIndex);
+          }
+          catch (ZorbaException& e) {
+            fail(e.what());
+          }
+          catch (exception& e) {
+            fail(e.what());
+          }
+          catch (...) {
+            fail(0);
+          }
+        }
+      }
+    };
+
+    class Worker : public Thread {
+      public:
+        Worker(WorkState& aState) : theState(aState) {}
+        virtual ~Worker() { join(); }
+      protected:
+        virtual void run() { theState.work(); }
+      private:
+        WorkState& theState;
+    };
+
+  }
+
+  string parallelFor(size_t aCount, unsigned aThreads, ParallelTask& aTask)
+  {
+    WorkState lState;
+    lState.theTask = &aTask;
+    lState.theCount = aCount;
+    lState.theNext = 0;
+
+    size_t lHelpers = aThreads > 1 ? aThreads - 1 : 0;
+    if (lHelpers + 1 > aCount) {
+      lHelpers = aCount > 0 ? aCount - 1 : 0;
+    }
+    vector<Worker*> lWorkers;
+    for (size_t i = 0; i < lHelpers; ++i) {
+      // Without a helper the calling thread just does more of the work
+      Worker* lWorker = new Worker(lState);
+      if (!lWorker->start()) {
+        delete lWorker;
+        break;
+      }
+      lWorkers.push_back(lWorker);
+    }
+    lState.work();
+    for (size_t i = 0; i < lWorkers.size(); ++i) {
+      delete lWorkers[i];
+    }
+    return lState.theError;
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
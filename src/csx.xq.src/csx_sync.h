@@ -0,0 +1,179 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_SYNC_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_SYNC_H__
+
+#ifdef WIN32
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#  include <unistd.h>
+#endif
+#include <string>
+
+namespace zorba { namespace csx {
+
+  /**
+   * Minimal non-recursive mutex.
+   */
+  class Mutex {
+    public:
+#ifdef WIN32
+      Mutex() { InitializeCriticalSection(&theMutex); }
+      ~Mutex() { DeleteCriticalSection(&theMutex); }
+      void lock() { EnterCriticalSection(&theMutex); }
+      void unlock() { LeaveCriticalSection(&theMutex); }
+#else
+      Mutex() { pthread_mutex_init(&theMutex, 0); }
+      ~Mutex() { pthread_mutex_destroy(&theMutex); }
+      void lock() { pthread_mutex_lock(&theMutex); }
+      void unlock() { pthread_mutex_unlock(&theMutex); }
+#endif
+
+    private:
+      friend class Condition;
+
+      Mutex(const Mutex&);
+      Mutex& operator=(const Mutex&);
+
+#ifdef WIN32
+      CRITICAL_SECTION theMutex;
+#else
+      pthread_mutex_t theMutex;
+#endif
+  };
+
+  class ScopedLock {
+    public:
+      ScopedLock(Mutex& aMutex) : theMutex(aMutex) { theMutex.lock(); }
+      ~ScopedLock() { theMutex.unlock(); }
+
+    private:
+      ScopedLock(const ScopedLock&);
+      ScopedLock& operator=(const ScopedLock&);
+
+      Mutex& theMutex;
+  };
+
+  /**
+   * Condition variable to be used together with a locked Mutex.
+   */
+  class Condition {
+    public:
+#ifdef WIN32
+      Condition() { InitializeConditionVariable(&theCondition); }
+      ~Condition() {}
+      void wait(Mutex& aMutex) {
+        SleepConditionVariableCS(&theCondition, &aMutex.theMutex, INFINITE);
+      }
+      void notifyOne() { WakeConditionVariable(&theCondition); }
+      void notifyAll() { WakeAllConditionVariable(&theCondition); }
+#else
+      Condition() { pthread_cond_init(&theCondition, 0); }
+      ~Condition() { pthread_cond_destroy(&theCondition); }
+      void wait(Mutex& aMutex) { pthread_cond_wait(&theCondition, &aMutex.theMutex); }
+      void notifyOne() { pthread_cond_signal(&theCondition); }
+      void notifyAll() { pthread_cond_broadcast(&theCondition); }
+#endif
+
+    private:
+      Condition(const Condition&);
+      Condition& operator=(const Condition&);
+
+#ifdef WIN32
+      CONDITION_VARIABLE theCondition;
+#else
+      pthread_cond_t theCondition;
+#endif
+  };
+
+  /**
+   * A joinable thread running run(). Subclasses must join() before their
+   * own members go away.
+   */
+  class Thread {
+    public:
+      Thread() : theStarted(false) {}
+      virtual ~Thread() {}
+
+      // False if the system could not create the thread
+      bool start() {
+#ifdef WIN32
+        theThread = CreateThread(0, 0, &Thread::entry, this, 0, 0);
+        theStarted = theThread != 0;
+#else
+        theStarted = pthread_create(&theThread, 0, &Thread::entry, this) == 0;
+#endif
+        return theStarted;
+      }
+
+      void join() {
+        if (!theStarted) {
+          return;
+        }
+#ifdef WIN32
+        WaitForSingleObject(theThread, INFINITE);
+        CloseHandle(theThread);
+#else
+        pthread_join(theThread, 0);
+#endif
+        theStarted = false;
+      }
+
+      bool isStarted() const { return theStarted; }
+
+    protected:
+      virtual void run() = 0;
+
+    private:
+      Thread(const Thread&);
+      Thread& operator=(const Thread&);
+
+#ifdef WIN32
+      static DWORD WINAPI entry(LPVOID aThread) {
+        static_cast<Thread*>(aThread)->run();
+        return 0;
+      }
+
+      HANDLE theThread;
+#else
+      static void* entry(void* aThread) {
+        static_cast<Thread*>(aThread)->run();
+        return 0;
+      }
+
+      pthread_t theThread;
+#endif
+      bool theStarted;
+  };
+
+  /**
+   * Number of hardware threads; at least 1.
+   */
+  inline unsigned hardwareConcurrency()
+  {
+#ifdef WIN32
+    SYSTEM_INFO lInfo;
+    GetSystemInfo(&lInfo);
+    long lCount = lInfo.dwNumberOfProcessors;
+#else
+    long lCount = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return lCount > 0 ? (unsigned)lCount : 1;
+  }
+
+  /**
+   * One unit of work per index, for parallelFor().
+   */
+  class ParallelTask {
+    public:
+      virtual ~ParallelTask() {}
+      virtual void run(size_t aIndex) = 0;
+  };
+
+  // Runs aTask.run(i) for every i in [0, aCount) on up to aThreads threads,
+  // the calling one included. Returns the message of the first exception a
+  // task threw (the remaining indexes are then skipped), or an empty string.
+  std::string parallelFor(size_t aCount, unsigned aThreads, ParallelTask& aTask);
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_SYNC_H__
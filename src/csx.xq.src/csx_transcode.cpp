@@ -0,0 +1,375 @@
+#include <libxml/xmlreader.h>
+#include <libxml/xmlversion.h>
+#include <sstream>
+#include <string.h>
+
+#include "csx.h"
+#include "csx_transcode.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  // Internal entities are substituted but external ones are never loaded,
+  // so input cannot pull in local files (XXE). Before libxml2 2.13 NOENT
+  // would also load external entities, so references are left unexpanded
+  // there and rejected in read().
+#if LIBXML_VERSION >= 21300
+  static const int XML_READER_OPTIONS = XML_PARSE_NOENT | XML_PARSE_NO_XXE | XML_PARSE_NONET;
+#else
+  static const int XML_READER_OPTIONS = XML_PARSE_NONET;
+#endif
+
+  static void assign(string& aTarget, const xmlChar* aValue)
+  {
+    if (aValue) {
+      aTarget.assign((const char*)aValue);
+    }
+    else {
+      aTarget.clear();
+    }
+  }
+
+  static int readFromStream(void* aContext, char* aBuffer, int aLength)
+  {
+    istream& lInput = *static_cast<istream*>(aContext);
+    lInput.read(aBuffer, aLength);
+    if (lInput.bad()) {
+      return -1;
+    }
+    return (int)lInput.gcount();
+  }
+
+  static int closeNothing(void*)
+  {
+    return 0;
+  }
+
+  // Keeps the first error for the csx:CSX0007 message instead of letting
+  // libxml2 print it
+  static void keepError(void* aContext, const char* aMessage,
+                        xmlParserSeverities aSeverity, xmlTextReaderLocatorPtr aLocator)
+  {
+    string& lError = *static_cast<string*>(aContext);
+    if (!lError.empty() || aSeverity == XML_PARSER_SEVERITY_WARNING ||
+        aSeverity == XML_PARSER_SEVERITY_VALIDITY_WARNING) {
+      return;
+    }
+    ostringstream lMessage;
+    lMessage << "line " << xmlTextReaderLocatorLineNumber(aLocator) << ": " << aMessage;
+    lError = lMessage.str();
+    while (!lError.empty() && lError[lError.size() - 1] == '\n') {
+      lError.erase(lError.size() - 1);
+    }
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  void XmlEventReader::readStream(istream& aInput)
+  {
+    xmlTextReaderPtr lReader = xmlReaderForIO(readFromStream, closeNothing, &aInput,
+                                              0, 0, XML_READER_OPTIONS);
+    read(lReader, "input");
+  }
+
+  void XmlEventReader::readFile(const string& aPath)
+  {
+    xmlTextReaderPtr lReader = xmlReaderForFile(aPath.c_str(), 0, XML_READER_OPTIONS);
+    read(lReader, aPath);
+  }
+
+  void XmlEventReader::read(xmlTextReaderPtr aReader, const string& aSource)
+  {
+    if (!aReader) {
+      CSXModule::raiseError("CSX0007", "cannot read XML from " + aSource);
+    }
+
+    string lError;
+    xmlTextReaderSetErrorHandler(aReader, keepError, &lError);
+    int lResult;
+    try {
+      while ((lResult = xmlTextReaderRead(aReader)) == 1) {
+        switch (xmlTextReaderNodeType(aReader)) {
+          case XML_READER_TYPE_ELEMENT:
+            flushText();
+            startElement(aReader);
+            break;
+          case XML_READER_TYPE_END_ELEMENT:
+            flushText();
+            endElement(aReader);
+            break;
+          case XML_READER_TYPE_TEXT:
+          case XML_READER_TYPE_CDATA:
+          case XML_READER_TYPE_WHITESPACE:
+          case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
+            // Like the store, which drops whitespace outside the document
+            // element and merges adjacent text
+            if (theDepth > 0) {
+              const xmlChar* lValue = xmlTextReaderConstValue(aReader);
+              if (lValue) {
+                theText += (const char*)lValue;
+              }
+            }
+            break;
+          case XML_READER_TYPE_COMMENT: {
+            flushText();
+            string lText;
+            assign(lText, xmlTextReaderConstValue(aReader));
+            theHandler.comment(lText);
+            break;
+          }
+          case XML_READER_TYPE_PROCESSING_INSTRUCTION: {
+            flushText();
+            string lTarget;
+            string lData;
+            assign(lTarget, xmlTextReaderConstName(aReader));
+            assign(lData, xmlTextReaderConstValue(aReader));
+            theHandler.processingInstruction(lTarget, lData);
+            break;
+          }
+          case XML_READER_TYPE_ENTITY_REFERENCE: {
+            string lName;
+            assign(lName, xmlTextReaderConstName(aReader));
+            CSXModule::raiseError("CSX0007", aSource + " references entity &"
+                                  + lName + "; which is not expanded");
+            break;
+          }
+          default:
+            // Document type declarations and the like have no CSX event
+            break;
+        }
+      }
+    }
+    catch (...) {
+      xmlFreeTextReader(aReader);
+      throw;
+    }
+    xmlFreeTextReader(aReader);
+    if (lResult != 0) {
+      CSXModule::raiseError("CSX0007", aSource + " is not well-formed XML: " + lError);
+    }
+  }
+
+  void XmlEventReader::startElement(xmlTextReaderPtr aReader)
+  {
+    assign(theUri, xmlTextReaderConstNamespaceUri(aReader));
+    assign(theLocalName, xmlTextReaderConstLocalName(aReader));
+    assign(thePrefix, xmlTextReaderConstPrefix(aReader));
+    bool lEmpty = xmlTextReaderIsEmptyElement(aReader) == 1;
+
+    // Namespace declarations come before the element, the other attributes
+    // after it, so collect both first
+    theBindings.clear();
+    theAttributeCount = 0;
+    while (xmlTextReaderMoveToNextAttribute(aReader) == 1) {
+      if (xmlTextReaderIsNamespaceDecl(aReader) == 1) {
+        theBindings.push_back(pair<string, string>());
+        pair<string, string>& lBinding = theBindings.back();
+        // xmlns has no prefix and is the local name; xmlns:p has local name p
+        if (xmlTextReaderConstPrefix(aReader)) {
+          assign(lBinding.first, xmlTextReaderConstLocalName(aReader));
+        }
+        assign(lBinding.second, xmlTextReaderConstValue(aReader));
+        continue;
+      }
+      if (theAttributes.size() <= theAttributeCount) {
+        theAttributes.resize(theAttributeCount + 1);
+      }
+      Attribute& lAttr = theAttributes[theAttributeCount++];
+      assign(lAttr.theUri, xmlTextReaderConstNamespaceUri(aReader));
+      assign(lAttr.theLocalName, xmlTextReaderConstLocalName(aReader));
+      assign(lAttr.thePrefix, xmlTextReaderConstPrefix(aReader));
+      assign(lAttr.theValue, xmlTextReaderConstValue(aReader));
+    }
+    xmlTextReaderMoveToElement(aReader);
+
+    theHandler.startElement(theUri, theLocalName, thePrefix, &theBindings);
+    ++theCounters.theElements;
+    // Untyped attributes are written as strings, as Traverser does
+    theAtomic.m_type = opencsx::DT_STRING;
+    for (size_t i = 0; i < theAttributeCount; ++i) {
+      const Attribute& lAttr = theAttributes[i];
+      theAtomic.m_string = lAttr.theValue;
+      theHandler.attribute(lAttr.theUri, lAttr.theLocalName, lAttr.thePrefix, theAtomic);
+      ++theCounters.theAttributes;
+    }
+
+    if (lEmpty) {
+      theHandler.endElement(theUri, theLocalName, thePrefix);
+    }
+    else {
+      ++theDepth;
+    }
+  }
+
+  void XmlEventReader::endElement(xmlTextReaderPtr aReader)
+  {
+    assign(theUri, xmlTextReaderConstNamespaceUri(aReader));
+    assign(theLocalName, xmlTextReaderConstLocalName(aReader));
+    assign(thePrefix, xmlTextReaderConstPrefix(aReader));
+    theHandler.endElement(theUri, theLocalName, thePrefix);
+    --theDepth;
+  }
+
+  void XmlEventReader::flushText()
+  {
+    if (theText.empty()) {
+      return;
+    }
+    theAtomic.m_type = opencsx::DT_ANYATOMIC;
+    theAtomic.m_string.swap(theText);
+    theHandler.atomicValue(theAtomic);
+    theCounters.theTextBytes += theAtomic.m_string.size();
+    theText.clear();
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  XmlWriter::XmlWriter(ostream& aOut)
+    : theOut(aOut),
+      theItemFactory(Zorba::getInstance(0)->getItemFactory()),
+      theInStartTag(false),
+      theAfterAtomic(false)
+  {
+  }
+
+  void XmlWriter::startElement(const string& uri, const string& localname,
+                               const string& prefix,
+                               const opencsx::CSXHandler::NsBindings* bindings)
+  {
+    closeStartTag();
+    theOut << '<';
+    writeName(prefix, localname);
+    if (bindings) {
+      for (size_t i = 0; i < bindings->size(); ++i) {
+        const pair<string, string>& lBinding = (*bindings)[i];
+        theOut << (lBinding.first.empty() ? " xmlns" : " xmlns:") << lBinding.first << "=\"";
+        writeEscaped(lBinding.second, true);
+        theOut << '"';
+      }
+    }
+    theInStartTag = true;
+    theAfterAtomic = false;
+  }
+
+  void XmlWriter::endElement(const string& uri, const string& localname,
+                             const string& prefix)
+  {
+    if (theInStartTag) {
+      theOut << "/>";
+      theInStartTag = false;
+    }
+    else {
+      theOut << "</";
+      writeName(prefix, localname);
+      theOut << '>';
+    }
+    theAfterAtomic = false;
+  }
+
+  void XmlWriter::attribute(const string& uri, const string& localname,
+                            const string& prefix, const opencsx::AtomicValue& value)
+  {
+    theOut << ' ';
+    writeName(prefix, localname);
+    theOut << "=\"";
+    writeEscaped(lexical(value), true);
+    theOut << '"';
+  }
+
+  void XmlWriter::atomicValue(const opencsx::AtomicValue& value)
+  {
+    closeStartTag();
+    bool lTyped = value.m_type != opencsx::DT_ANYATOMIC;
+    if (lTyped && theAfterAtomic) {
+      theOut << ' ';
+    }
+    writeEscaped(lexical(value), false);
+    theAfterAtomic = lTyped;
+  }
+
+  void XmlWriter::processingInstruction(const string& target, const string& data)
+  {
+    closeStartTag();
+    theOut << "<?" << target;
+    if (!data.empty()) {
+      theOut << ' ' << data;
+    }
+    theOut << "?>";
+    theAfterAtomic = false;
+  }
+
+  void XmlWriter::comment(const string& text)
+  {
+    closeStartTag();
+    theOut << "<!--" << text << "-->";
+    theAfterAtomic = false;
+  }
+
+  void XmlWriter::closeStartTag()
+  {
+    if (theInStartTag) {
+      theOut << '>';
+      theInStartTag = false;
+    }
+  }
+
+  void XmlWriter::writeName(const string& aPrefix, const string& aLocalName)
+  {
+    if (!aPrefix.empty()) {
+      theOut << aPrefix << ':';
+    }
+    theOut << aLocalName;
+  }
+
+  void XmlWriter::writeEscaped(const string& aText, bool aAttribute)
+  {
+    // Write runs of plain characters in one go
+    const char* lText = aText.data();
+    size_t lStart = 0;
+    for (size_t i = 0; i < aText.size(); ++i) {
+      const char* lEntity;
+      switch (lText[i]) {
+        case '&': lEntity = "&amp;"; break;
+        case '<': lEntity = "&lt;"; break;
+        case '>': lEntity = aAttribute ? 0 : "&gt;"; break;
+        case '"': lEntity = aAttribute ? "&quot;" : 0; break;
+        case '\r': lEntity = "&#xD;"; break;
+        case '\n': lEntity = aAttribute ? "&#xA;" : 0; break;
+        case '\t': lEntity = aAttribute ? "&#x9;" : 0; break;
+        default: lEntity = 0;
+      }
+      if (lEntity) {
+        theOut.write(lText + lStart, (streamsize)(i - lStart));
+        theOut << lEntity;
+        lStart = i + 1;
+      }
+    }
+    theOut.write(lText + lStart, (streamsize)(aText.size() - lStart));
+  }
+
+  string XmlWriter::lexical(const opencsx::AtomicValue& aValue)
+  {
+    // Typed values take the canonical form Zorba would serialize them in
+    switch (aValue.m_type) {
+      case opencsx::DT_BOOLEAN:
+        return aValue.m_value.f_bool ? "true" : "false";
+      case opencsx::DT_BYTE:
+        return theItemFactory->createByte((signed char)aValue.m_value.f_char)
+          .getStringValue().str();
+      case opencsx::DT_INT:
+        return theItemFactory->createInt(aValue.m_value.f_int).getStringValue().str();
+      case opencsx::DT_LONG:
+        return theItemFactory->createLong(aValue.m_value.f_long).getStringValue().str();
+      case opencsx::DT_FLOAT:
+        return theItemFactory->createFloat(aValue.m_value.f_float).getStringValue().str();
+      case opencsx::DT_DOUBLE:
+        return theItemFactory->createDouble(aValue.m_value.f_double).getStringValue().str();
+      default:
+        return aValue.m_string;
+    }
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
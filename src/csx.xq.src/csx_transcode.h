@@ -0,0 +1,95 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_TRANSCODE_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_TRANSCODE_H__
+
+#include <zorba/zorba.h>
+#include <zorba/item_factory.h>
+#include <opencsx/csxhandler.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "csx_stats.h"
+
+struct _xmlTextReader;
+
+namespace zorba { namespace csx {
+
+  /**
+   * Reads XML text with libxml2's pull parser and hands it to a CSXHandler
+   * as the events Traverser would emit for the parsed document, without
+   * building any nodes. Only the element being read is held in memory.
+   */
+  class XmlEventReader {
+    public:
+      XmlEventReader(opencsx::CSXHandler& aHandler, Counters& aCounters)
+        : theHandler(aHandler), theCounters(aCounters), theDepth(0),
+          theAttributeCount(0) {}
+
+      // Both raise csx:CSX0007 if the input is not well-formed XML
+      void readStream(std::istream& aInput);
+      void readFile(const std::string& aPath);
+
+    private:
+      struct Attribute {
+        std::string theUri;
+        std::string theLocalName;
+        std::string thePrefix;
+        std::string theValue;
+      };
+
+      void read(_xmlTextReader* aReader, const std::string& aSource);
+      void startElement(_xmlTextReader* aReader);
+      void endElement(_xmlTextReader* aReader);
+      void flushText();
+
+      opencsx::CSXHandler& theHandler;
+      Counters& theCounters;
+      int theDepth;
+
+      // Scratch state reused for every node
+      std::string theUri;
+      std::string theLocalName;
+      std::string thePrefix;
+      opencsx::CSXHandler::NsBindings theBindings;
+      std::vector<Attribute> theAttributes;
+      size_t theAttributeCount;
+      std::string theText;
+      opencsx::AtomicValue theAtomic;
+  };
+
+  /**
+   * Writes the events of a CSX stream as XML text, the way Zorba would
+   * serialize the nodes csx:parse() builds from them.
+   */
+  class XmlWriter : public opencsx::CSXHandler {
+    public:
+      XmlWriter(std::ostream& aOut);
+
+      void startDocument() {}
+      void endDocument() {}
+      void startElement(const std::string& uri, const std::string& localname,
+                        const std::string& prefix,
+                        const opencsx::CSXHandler::NsBindings* bindings);
+      void endElement(const std::string& uri, const std::string& localname,
+                      const std::string& prefix);
+      void attribute(const std::string& uri, const std::string& localname,
+                     const std::string& prefix, const opencsx::AtomicValue& value);
+      void atomicValue(const opencsx::AtomicValue& value);
+      void processingInstruction(const std::string& target, const std::string& data);
+      void comment(const std::string& text);
+
+    private:
+      void closeStartTag();
+      void writeName(const std::string& aPrefix, const std::string& aLocalName);
+      void writeEscaped(const std::string& aText, bool aAttribute);
+      std::string lexical(const opencsx::AtomicValue& aValue);
+
+      std::ostream& theOut;
+      ItemFactory* theItemFactory;
+      bool theInStartTag;
+      bool theAfterAtomic;    // separates consecutive typed values
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_TRANSCODE_H__
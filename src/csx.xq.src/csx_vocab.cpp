@@ -0,0 +1,192 @@
+#include <zorba/store_manager.h>
+
+#include <sstream>
+#include <vector>
+#include <stdio.h>
+
+#include "csx_vocab.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  static VocabularyCache theVocabularyCache;
+
+  // FNV-1a; 0 is reserved for "not loaded"
+  static uint64_t hashBytes(const string& aData)
+  {
+    uint64_t lHash = 14695981039346656037ULL;
+    for (string::const_iterator ite = aData.begin(); ite != aData.end(); ++ite) {
+      lHash ^= (unsigned char)*ite;
+      lHash *= 1099511628211ULL;
+    }
+    return lHash != 0 ? lHash : 1;
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  VocabularyCache& VocabularyCache::instance()
+  {
+    return theVocabularyCache;
+  }
+
+  void VocabularyCache::load(const String& aUri, Entry& aEntry)
+  {
+    void *lStore = zorba::StoreManager::getStore();
+    Zorba* lZorba = Zorba::getInstance(lStore);
+    Item vocab_item = lZorba->getXmlDataManager()->fetch(aUri);
+    ostringstream lBytes;
+    lBytes << vocab_item.getStream().rdbuf();
+    aEntry.theData = lBytes.str();
+    aEntry.theHash = hashBytes(aEntry.theData);
+  }
+
+  uint64_t VocabularyCache::fetch(const String& aUri, uint64_t aHeld, string& aData)
+  {
+    string lKey = aUri.str();
+    {
+      ScopedLock lLock(theMutex);
+      map<string, Entry>::const_iterator ite = theEntries.find(lKey);
+      if (ite != theEntries.end()) {
+        if (ite->second.theHash != aHeld) {
+          aData = ite->second.theData;
+        }
+        return ite->second.theHash;
+      }
+    }
+
+    // Fetch outside the lock; if another thread got there first, keep theirs
+    Entry lEntry;
+    load(aUri, lEntry);
+
+    ScopedLock lLock(theMutex);
+    Entry& lCached = theEntries[lKey];
+    if (lCached.theData.empty() && lCached.theHash == 0) {
+      lCached.theData.swap(lEntry.theData);
+      lCached.theHash = lEntry.theHash;
+    }
+    if (lCached.theHash != aHeld) {
+      aData = lCached.theData;
+    }
+    return lCached.theHash;
+  }
+
+  uint64_t VocabularyCache::reload(const String& aUri)
+  {
+    Entry lEntry;
+    load(aUri, lEntry);
+
+    ScopedLock lLock(theMutex);
+    Entry& lCached = theEntries[aUri.str()];
+    lCached.theData.swap(lEntry.theData);
+    lCached.theHash = lEntry.theHash;
+    return lCached.theHash;
+  }
+
+  bool VocabularyCache::evict(const String& aUri)
+  {
+    ScopedLock lLock(theMutex);
+    return theEntries.erase(aUri.str()) > 0;
+  }
+
+  String VocabularyCache::hashToString(uint64_t aHash)
+  {
+    char lBuf[17];
+    sprintf(lBuf, "%08x%08x", (unsigned)(aHash >> 32), (unsigned)(aHash & 0xffffffff));
+    return String(lBuf);
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  VocabProcessor::VocabProcessor()
+    : theNames(theCounters)
+  {
+    theProcessor = opencsx::CSXProcessor::create();
+  }
+
+  VocabProcessor::~VocabProcessor()
+  {
+    delete theProcessor;
+  }
+
+  void VocabProcessor::reset()
+  {
+    delete theProcessor;
+    theProcessor = opencsx::CSXProcessor::create();
+    theVocabs.clear();
+    theOrder.clear();
+  }
+
+  bool VocabProcessor::holds(const vector<String>& aUris) const
+  {
+    if (aUris.size() != theOrder.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < aUris.size(); ++i) {
+      if (aUris[i].str() != theOrder[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint64_t VocabProcessor::getFingerprint(const vector<String>& aUris) const
+  {
+    // In the order given, as that is the order they are loaded in
+    string lHashes;
+    for (vector<String>::const_iterator ite = aUris.begin(); ite != aUris.end(); ++ite) {
+      map<string, uint64_t>::const_iterator lHeld = theVocabs.find(ite->str());
+      lHashes += VocabularyCache::hashToString(lHeld == theVocabs.end() ? 0 : lHeld->second).str();
+    }
+    return hashBytes(lHashes);
+  }
+
+  void VocabProcessor::loadVocabs(const vector<String>& aUris)
+  {
+    PhaseTimer lTimer(theCounters.theVocabularyTime);
+    VocabularyCache& lCache = VocabularyCache::instance();
+    vector<uint64_t> lHashes(aUris.size());
+    vector<string> lData(aUris.size());
+    bool lStale = false;
+
+    for (size_t i = 0; i < aUris.size(); ++i) {
+      map<string, uint64_t>::const_iterator ite = theVocabs.find(aUris[i].str());
+      uint64_t lHeld = (ite == theVocabs.end()) ? 0 : ite->second;
+      lHashes[i] = lCache.fetch(aUris[i], lHeld, lData[i]);
+      if (lHeld != 0 && lHashes[i] != lHeld) {
+        lStale = true;
+      }
+    }
+
+    if (lStale) {
+      // OpenCSX cannot unload a vocabulary, so start over with a fresh
+      // processor and load everything that was asked for.
+      reset();
+      for (size_t i = 0; i < aUris.size(); ++i) {
+        if (lData[i].empty()) {
+          lHashes[i] = lCache.fetch(aUris[i], 0, lData[i]);
+        }
+      }
+    }
+
+    for (size_t i = 0; i < aUris.size(); ++i) {
+      string lUri = aUris[i].str();
+      map<string, uint64_t>::iterator ite = theVocabs.find(lUri);
+      if (ite == theVocabs.end()) {
+        ite = theVocabs.insert(make_pair(lUri, (uint64_t)0)).first;
+        theOrder.push_back(lUri);
+      }
+      uint64_t& lHeld = ite->second;
+      if (lHeld == lHashes[i]) {
+        continue;
+      }
+      istringstream lStream(lData[i]);
+      theProcessor->loadVocabulary(lStream);
+      lHeld = lHashes[i];
+      ++theCounters.theVocabularyLoads;
+    }
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
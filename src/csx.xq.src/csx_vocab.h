@@ -0,0 +1,101 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_VOCAB_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_VOCAB_H__
+
+#include <zorba/zorba.h>
+#include <opencsx/csxprocessor.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "csx_names.h"
+#include "csx_scratch.h"
+#include "csx_stats.h"
+#include "csx_sync.h"
+
+namespace zorba { namespace csx {
+
+  /**
+   * Process-wide cache of OpenCSX vocabulary files, keyed by URI. Each entry
+   * carries a hash of its content, which processors use to tell whether the
+   * vocabulary they loaded earlier is still current.
+   */
+  class VocabularyCache {
+    public:
+      static VocabularyCache& instance();
+
+      // Returns the content hash of aUri, fetching it if it is not cached.
+      // If the hash differs from aHeld, the vocabulary bytes are copied
+      // into aData.
+      uint64_t fetch(const String& aUri, uint64_t aHeld, std::string& aData);
+
+      // Fetches aUri again, replacing any cached copy; returns the new hash.
+      uint64_t reload(const String& aUri);
+
+      // Drops aUri from the cache; returns false if it was not cached.
+      bool evict(const String& aUri);
+
+      static String hashToString(uint64_t aHash);
+
+    private:
+      struct Entry {
+        std::string theData;
+        uint64_t theHash;
+      };
+
+      static void load(const String& aUri, Entry& aEntry);
+
+      Mutex theMutex;
+      std::map<std::string, Entry> theEntries;
+  };
+
+  /**
+   * An OpenCSX processor together with the vocabularies (URI and content
+   * hash) that have been loaded into it, the names it has interned and the
+   * scratch storage of the parses run on it.
+   */
+  class VocabProcessor {
+    public:
+      VocabProcessor();
+      ~VocabProcessor();
+
+      opencsx::CSXProcessor* get() const { return theProcessor; }
+
+      // Names interned by the parses that ran on this processor
+      NameCache& getNameCache() { return theNames; }
+
+      // Storage the parser handler keeps between parses on this processor
+      ParseScratch& getParseScratch() { return theScratch; }
+
+      // Work done since the pool last collected it
+      Counters& getCounters() { return theCounters; }
+
+      // Makes sure the current version of every URI in aUris is loaded,
+      // consulting the VocabularyCache only for the hashes.
+      void loadVocabs(const std::vector<String>& aUris);
+
+      // True if exactly the vocabularies in aUris have been loaded, in that
+      // order (and in whatever version).
+      bool holds(const std::vector<String>& aUris) const;
+
+      // Identifies the content of the vocabularies in aUris, as loaded by
+      // loadVocabs(); never 0
+      uint64_t getFingerprint(const std::vector<String>& aUris) const;
+
+    private:
+      VocabProcessor(const VocabProcessor&);
+      VocabProcessor& operator=(const VocabProcessor&);
+
+      void reset();
+
+      opencsx::CSXProcessor* theProcessor;
+      std::map<std::string, uint64_t> theVocabs;
+      std::vector<std::string> theOrder;    // URIs in the order loaded
+      Counters theCounters;
+      NameCache theNames;       // counts into theCounters
+      ParseScratch theScratch;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_VOCAB_H__
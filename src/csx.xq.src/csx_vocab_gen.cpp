@@ -0,0 +1,446 @@
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "csx_vocab_gen.h"
+
+namespace zorba { namespace csx {
+
+  using namespace std;
+
+  // Smaller IDs are taken by the names every OpenCSX vocabulary predefines
+  static const uint64_t FIRST_PROPERTY_ID = 0x41;
+
+  static const char* const XML_NAMESPACE = "http://www.w3.org/XML/1998/namespace";
+  static const char* const XMLNS_NAMESPACE = "http://www.w3.org/2000/xmlns/";
+  static const char* const XSI_NAMESPACE = "http://www.w3.org/2001/XMLSchema-instance";
+  static const char* const CSX_ANNOTATION_NAMESPACE = "http://xmlns.oracle.com/2004/CSX";
+
+  VocabularyGenerator::VocabularyGenerator()
+    : theHasIds(false)
+  {
+  }
+
+  void VocabularyGenerator::startElement(const string& uri, const string& localname,
+                                         const string&,
+                                         const opencsx::CSXHandler::NsBindings*)
+  {
+    Name lName(uri, localname);
+    if (!theStack.empty()) {
+      theStack.back().theHasChildren = true;
+      addOnce(theStack.back().theInfo->theChildren, lName);
+    }
+    ElementInfo& lInfo = theElements[lName];
+    ++lInfo.theCount;
+
+    theStack.push_back(Frame());
+    Frame& lFrame = theStack.back();
+    lFrame.theName = lName;
+    lFrame.theInfo = &lInfo;
+    lFrame.theTypes = T_ALL;
+    lFrame.theValues = 0;
+    lFrame.theHasChildren = false;
+    theHasIds = false;
+  }
+
+  void VocabularyGenerator::endElement(const string&, const string&, const string&)
+  {
+    Frame& lFrame = theStack.back();
+    ElementInfo& lInfo = *lFrame.theInfo;
+    bool lHasText = lFrame.theText.find_first_not_of(" \t\r\n") != string::npos;
+    if (lFrame.theHasChildren) {
+      lInfo.theHasText = lInfo.theHasText || lHasText;
+    }
+    else if (lFrame.theValues == 0 && lFrame.theText.empty()) {
+      lInfo.theHasEmpty = true;
+    }
+    else {
+      lInfo.theHasValue = true;
+      if (lFrame.theValues == 0) {
+        lInfo.theTypes &= typesOf(lFrame.theText);
+      }
+      else if (lFrame.theValues == 1 && !lHasText) {
+        lInfo.theTypes &= lFrame.theTypes;
+      }
+      else {
+        // A list, or values mixed with text
+        lInfo.theTypes = 0;
+      }
+    }
+    theStack.pop_back();
+  }
+
+  void VocabularyGenerator::attribute(const string& uri, const string& localname,
+                                      const string&, const opencsx::AtomicValue& value)
+  {
+    if (theStack.empty() || isReserved(uri)) {
+      return;
+    }
+    Name lName(uri, localname);
+    Frame& lElement = theStack.back();
+    addOnce(lElement.theInfo->theAttributes, lName);
+
+    AttributeInfo* lInfo;
+    if (uri.empty()) {
+      // Unqualified attributes are local to their element
+      lInfo = &theLocalAttributes[make_pair(lElement.theName, localname)];
+    }
+    else {
+      lInfo = &theAttributes[lName];
+    }
+    ++lInfo->theCount;
+    lInfo->theTypes &= typesOf(value);
+  }
+
+  void VocabularyGenerator::atomicValue(const opencsx::AtomicValue& value)
+  {
+    if (theStack.empty()) {
+      return;
+    }
+    Frame& lFrame = theStack.back();
+    if (value.m_type == opencsx::DT_ANYATOMIC) {
+      lFrame.theText += value.m_string;
+    }
+    else {
+      lFrame.theTypes &= typesOf(value);
+      ++lFrame.theValues;
+    }
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  unsigned VocabularyGenerator::typesOf(const opencsx::AtomicValue& aValue)
+  {
+    switch (aValue.m_type) {
+      case opencsx::DT_BOOLEAN:
+        return T_BOOLEAN;
+      case opencsx::DT_BYTE:
+      case opencsx::DT_INT:
+        return T_INT | T_LONG | T_DOUBLE;
+      case opencsx::DT_LONG:
+        return T_LONG | T_DOUBLE;
+      case opencsx::DT_FLOAT:
+      case opencsx::DT_DOUBLE:
+        return T_DOUBLE;
+      case opencsx::DT_ANYATOMIC:
+        return typesOf(aValue.m_string);
+      default:
+        return 0;
+    }
+  }
+
+  unsigned VocabularyGenerator::typesOf(const string& aLexical)
+  {
+    if (aLexical == "true" || aLexical == "false") {
+      return T_BOOLEAN;
+    }
+    // Only canonical integers: anything else would not read back as written.
+    // For the same reason decimals are never guessed to be xs:double.
+    size_t lDigits = (aLexical.size() > 0 && aLexical[0] == '-') ? 1 : 0;
+    if (lDigits == aLexical.size() ||
+        aLexical.find_first_not_of("0123456789", lDigits) != string::npos ||
+        (aLexical[lDigits] == '0' && aLexical.size() > lDigits + 1) ||
+        aLexical == "-0") {
+      return 0;
+    }
+    errno = 0;
+    long long lValue = strtoll(aLexical.c_str(), 0, 10);
+    if (errno == ERANGE) {
+      return 0;
+    }
+    if (lValue >= numeric_limits<int32_t>::min() &&
+        lValue <= numeric_limits<int32_t>::max()) {
+      return T_INT | T_LONG;
+    }
+    return T_LONG;
+  }
+
+  const char* VocabularyGenerator::typeName(unsigned aTypes)
+  {
+    if (aTypes & T_BOOLEAN) {
+      return "xs:boolean";
+    }
+    if (aTypes & T_INT) {
+      return "xs:int";
+    }
+    if (aTypes & T_LONG) {
+      return "xs:long";
+    }
+    if (aTypes & T_DOUBLE) {
+      return "xs:double";
+    }
+    return "xs:string";
+  }
+
+  bool VocabularyGenerator::isReserved(const string& aNamespace)
+  {
+    return aNamespace == XML_NAMESPACE || aNamespace == XMLNS_NAMESPACE ||
+           aNamespace == XSI_NAMESPACE;
+  }
+
+  void VocabularyGenerator::addOnce(vector<Name>& aNames, const Name& aName)
+  {
+    if (find(aNames.begin(), aNames.end(), aName) == aNames.end()) {
+      aNames.push_back(aName);
+    }
+  }
+
+  string VocabularyGenerator::escape(const string& aValue)
+  {
+    string lResult;
+    for (string::const_iterator ite = aValue.begin(); ite != aValue.end(); ++ite) {
+      switch (*ite) {
+        case '&': lResult += "&amp;"; break;
+        case '<': lResult += "&lt;"; break;
+        case '"': lResult += "&quot;"; break;
+        default: lResult += *ite;
+      }
+    }
+    return lResult;
+  }
+
+  /*******************************************************************************************
+  *******************************************************************************************/
+
+  namespace {
+
+    // Rankings put the most frequent first, and break ties in name order so
+    // that the result does not depend on the order of the samples
+    struct RankedNamespace {
+      uint64_t theCount;
+      string theUri;
+
+      bool operator<(const RankedNamespace& aOther) const {
+        if (theCount != aOther.theCount) {
+          return theCount > aOther.theCount;
+        }
+        return theUri < aOther.theUri;
+      }
+    };
+
+    // A name waiting for its ID
+    struct RankedName {
+      uint64_t theCount;
+      size_t theSequence;   // the name's place in sorted name order
+      uint64_t* theId;
+
+      bool operator<(const RankedName& aOther) const {
+        if (theCount != aOther.theCount) {
+          return theCount > aOther.theCount;
+        }
+        return theSequence < aOther.theSequence;
+      }
+    };
+
+    template<class Key, class Info>
+    void collect(const map<Key, Info>& aInfos, map<Key, uint64_t>& aIds,
+                 vector<RankedName>& aRanked)
+    {
+      for (typename map<Key, Info>::const_iterator ite = aInfos.begin();
+           ite != aInfos.end(); ++ite) {
+        RankedName lEntry;
+        lEntry.theCount = ite->second.theCount;
+        lEntry.theSequence = aRanked.size();
+        lEntry.theId = &aIds[ite->first];
+        aRanked.push_back(lEntry);
+      }
+    }
+
+  }
+
+  void VocabularyGenerator::assignIds()
+  {
+    if (theHasIds) {
+      return;
+    }
+    // Namespaces by the number of names in them that occurred
+    map<string, uint64_t> lCounts;
+    for (map<Name, ElementInfo>::const_iterator ite = theElements.begin();
+         ite != theElements.end(); ++ite) {
+      lCounts[ite->first.first] += ite->second.theCount;
+    }
+    for (map<Name, AttributeInfo>::const_iterator ite = theAttributes.begin();
+         ite != theAttributes.end(); ++ite) {
+      lCounts[ite->first.first] += ite->second.theCount;
+    }
+    vector<RankedNamespace> lRanked;
+    for (map<string, uint64_t>::const_iterator ite = lCounts.begin();
+         ite != lCounts.end(); ++ite) {
+      RankedNamespace lEntry;
+      lEntry.theCount = ite->second;
+      lEntry.theUri = ite->first;
+      lRanked.push_back(lEntry);
+    }
+    sort(lRanked.begin(), lRanked.end());
+    theNamespaces.clear();
+    thePrefixes.clear();
+    for (size_t i = 0; i < lRanked.size(); ++i) {
+      const string& lNamespace = lRanked[i].theUri;
+      theNamespaces.push_back(lNamespace);
+      if (!lNamespace.empty()) {
+        char lPrefix[24];
+        sprintf(lPrefix, "ns%u", (unsigned)thePrefixes.size() + 1);
+        thePrefixes[lNamespace] = lPrefix;
+      }
+    }
+
+    // Element and attribute names share one ranking
+    theElementIds.clear();
+    theAttributeIds.clear();
+    theLocalAttributeIds.clear();
+    vector<RankedName> lNames;
+    collect(theElements, theElementIds, lNames);
+    collect(theAttributes, theAttributeIds, lNames);
+    collect(theLocalAttributes, theLocalAttributeIds, lNames);
+    sort(lNames.begin(), lNames.end());
+    for (size_t i = 0; i < lNames.size(); ++i) {
+      *lNames[i].theId = FIRST_PROPERTY_ID + i;
+    }
+    theHasIds = true;
+  }
+
+  void VocabularyGenerator::getNamespaces(vector<string>& aNamespaces)
+  {
+    assignIds();
+    aNamespaces = theNamespaces;
+  }
+
+  string VocabularyGenerator::qname(const Name& aName) const
+  {
+    map<string, string>::const_iterator ite = thePrefixes.find(aName.first);
+    if (ite == thePrefixes.end()) {
+      return aName.second;
+    }
+    return ite->second + ":" + aName.second;
+  }
+
+  void VocabularyGenerator::writeAttributes(const Name& aElement, const ElementInfo& aInfo,
+                                            ostream& aOut) const
+  {
+    for (size_t i = 0; i < aInfo.theAttributes.size(); ++i) {
+      const Name& lName = aInfo.theAttributes[i];
+      if (!lName.first.empty()) {
+        aOut << "<xs:attribute ref=\"" << qname(lName) << "\"/>\n";
+        continue;
+      }
+      pair<Name, string> lKey(aElement, lName.second);
+      aOut << "<xs:attribute name=\"" << lName.second << "\" type=\""
+           << typeName(theLocalAttributes.find(lKey)->second.theTypes)
+           << "\" csx:propertyID=\"" << theLocalAttributeIds.find(lKey)->second
+           << "\"/>\n";
+    }
+  }
+
+  void VocabularyGenerator::writeSchema(const string& aNamespace, ostream& aOut)
+  {
+    assignIds();
+
+    // Declarations of aNamespace in ID order, and the namespaces they use
+    vector<pair<uint64_t, Name> > lElements;
+    vector<pair<uint64_t, Name> > lAttributes;
+    set<string> lImports;
+    for (map<Name, ElementInfo>::const_iterator ite = theElements.begin();
+         ite != theElements.end(); ++ite) {
+      if (ite->first.first != aNamespace) {
+        continue;
+      }
+      lElements.push_back(make_pair(theElementIds[ite->first], ite->first));
+      const ElementInfo& lInfo = ite->second;
+      for (size_t i = 0; i < lInfo.theChildren.size(); ++i) {
+        lImports.insert(lInfo.theChildren[i].first);
+      }
+      for (size_t i = 0; i < lInfo.theAttributes.size(); ++i) {
+        if (!lInfo.theAttributes[i].first.empty()) {
+          lImports.insert(lInfo.theAttributes[i].first);
+        }
+      }
+    }
+    for (map<Name, AttributeInfo>::const_iterator ite = theAttributes.begin();
+         ite != theAttributes.end(); ++ite) {
+      if (ite->first.first == aNamespace) {
+        lAttributes.push_back(make_pair(theAttributeIds[ite->first], ite->first));
+      }
+    }
+    sort(lElements.begin(), lElements.end());
+    sort(lAttributes.begin(), lAttributes.end());
+    lImports.erase(aNamespace);
+
+    aOut << "<xs:schema xmlns:xs=\"http://www.w3.org/2001/XMLSchema\"\n"
+         << "           xmlns:csx=\"" << CSX_ANNOTATION_NAMESPACE << "\"\n";
+    for (size_t i = 0; i < theNamespaces.size(); ++i) {
+      if (!theNamespaces[i].empty()) {
+        aOut << "           xmlns:" << thePrefixes[theNamespaces[i]]
+             << "=\"" << escape(theNamespaces[i]) << "\"\n";
+      }
+    }
+    if (!aNamespace.empty()) {
+      aOut << "           targetNamespace=\"" << escape(aNamespace) << "\"\n";
+    }
+    aOut << "           elementFormDefault=\"qualified\">\n";
+
+    for (set<string>::const_iterator ite = lImports.begin(); ite != lImports.end(); ++ite) {
+      if (ite->empty()) {
+        aOut << "<xs:import/>\n";
+      }
+      else {
+        aOut << "<xs:import namespace=\"" << escape(*ite) << "\"/>\n";
+      }
+    }
+
+    for (size_t i = 0; i < lElements.size(); ++i) {
+      const Name& lName = lElements[i].second;
+      const ElementInfo& lInfo = theElements[lName];
+      unsigned lTypes = lInfo.theHasEmpty ? 0 : lInfo.theTypes;
+      aOut << "<xs:element name=\"" << lName.second
+           << "\" csx:propertyID=\"" << lElements[i].first << "\"";
+
+      if (lInfo.theChildren.empty() && lInfo.theAttributes.empty()) {
+        if (lInfo.theHasValue) {
+          aOut << " type=\"" << typeName(lTypes) << "\"/>\n";
+        }
+        else {
+          aOut << ">\n<xs:complexType/>\n</xs:element>\n";
+        }
+        continue;
+      }
+
+      aOut << ">\n";
+      if (!lInfo.theChildren.empty()) {
+        aOut << (lInfo.theHasText || lInfo.theHasValue ?
+                 "<xs:complexType mixed=\"true\">\n" : "<xs:complexType>\n")
+             << "<xs:choice minOccurs=\"0\" maxOccurs=\"unbounded\">\n";
+        for (size_t j = 0; j < lInfo.theChildren.size(); ++j) {
+          aOut << "<xs:element ref=\"" << qname(lInfo.theChildren[j]) << "\"/>\n";
+        }
+        aOut << "</xs:choice>\n";
+        writeAttributes(lName, lInfo, aOut);
+        aOut << "</xs:complexType>\n";
+      }
+      else if (lInfo.theHasValue) {
+        aOut << "<xs:complexType>\n<xs:simpleContent>\n"
+             << "<xs:extension base=\"" << typeName(lTypes) << "\">\n";
+        writeAttributes(lName, lInfo, aOut);
+        aOut << "</xs:extension>\n</xs:simpleContent>\n</xs:complexType>\n";
+      }
+      else {
+        aOut << "<xs:complexType>\n";
+        writeAttributes(lName, lInfo, aOut);
+        aOut << "</xs:complexType>\n";
+      }
+      aOut << "</xs:element>\n";
+    }
+
+    for (size_t i = 0; i < lAttributes.size(); ++i) {
+      const Name& lName = lAttributes[i].second;
+      aOut << "<xs:attribute name=\"" << lName.second << "\" type=\""
+           << typeName(theAttributes[lName].theTypes)
+           << "\" csx:propertyID=\"" << lAttributes[i].first << "\"/>\n";
+    }
+    aOut << "</xs:schema>\n";
+  }
+
+}/*namespace csx*/ }/*namespace zorba*/
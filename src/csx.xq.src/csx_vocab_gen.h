@@ -0,0 +1,118 @@
+#ifndef __COM_ZORBA_WWW_MODULES_CSX_VOCAB_GEN_H__
+#define __COM_ZORBA_WWW_MODULES_CSX_VOCAB_GEN_H__
+
+#include <opencsx/csxhandler.h>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace zorba { namespace csx {
+
+  /**
+   * Learns a vocabulary from the events of sample documents. Fed by a
+   * Traverser, it counts every element and attribute name, remembers which
+   * children and attributes each element had, and narrows down a type for
+   * simple content. writeSchema() then describes one namespace as an XML
+   * Schema carrying csx:propertyID annotations, the form from which OpenCSX
+   * vocabularies are compiled. Property IDs are handed out by frequency
+   * across all namespaces, so the most common names get the smallest IDs.
+   */
+  class VocabularyGenerator : public opencsx::CSXHandler {
+    public:
+      VocabularyGenerator();
+
+      void startDocument() {}
+      void endDocument() {}
+      void startElement(const std::string& uri, const std::string& localname,
+                        const std::string& prefix,
+                        const opencsx::CSXHandler::NsBindings* bindings);
+      void endElement(const std::string& uri, const std::string& localname,
+                      const std::string& prefix);
+      void attribute(const std::string& uri, const std::string& localname,
+                     const std::string& prefix, const opencsx::AtomicValue& value);
+      void atomicValue(const opencsx::AtomicValue& value);
+      void processingInstruction(const std::string&, const std::string&) {}
+      void comment(const std::string&) {}
+
+      // The namespaces seen, most frequent first; "" is no namespace
+      void getNamespaces(std::vector<std::string>& aNamespaces);
+
+      // Writes the schema document for aNamespace
+      void writeSchema(const std::string& aNamespace, std::ostream& aOut);
+
+    private:
+      // Bit set of the types all values seen so far conform to; none left
+      // means xs:string
+      enum TypeBits {
+        T_BOOLEAN = 1,
+        T_INT = 2,
+        T_LONG = 4,
+        T_DOUBLE = 8,
+        T_ALL = 15
+      };
+
+      // (namespace URI, local name)
+      typedef std::pair<std::string, std::string> Name;
+
+      struct AttributeInfo {
+        AttributeInfo() : theCount(0), theTypes(T_ALL) {}
+        uint64_t theCount;
+        unsigned theTypes;
+      };
+
+      struct ElementInfo {
+        ElementInfo()
+          : theCount(0), theTypes(T_ALL), theHasValue(false), theHasEmpty(false),
+            theHasText(false) {}
+        uint64_t theCount;
+        unsigned theTypes;
+        bool theHasValue;                   // some occurrence had simple content
+        bool theHasEmpty;                   // some occurrence had no content
+        bool theHasText;                    // text next to child elements
+        std::vector<Name> theChildren;      // in order of first appearance
+        std::vector<Name> theAttributes;    // qualified and unqualified
+      };
+
+      // One open element of the current sample
+      struct Frame {
+        Name theName;
+        ElementInfo* theInfo;
+        std::string theText;
+        unsigned theTypes;
+        size_t theValues;
+        bool theHasChildren;
+      };
+
+      static unsigned typesOf(const opencsx::AtomicValue& aValue);
+      static unsigned typesOf(const std::string& aLexical);
+      static const char* typeName(unsigned aTypes);
+      static bool isReserved(const std::string& aNamespace);
+
+      static void addOnce(std::vector<Name>& aNames, const Name& aName);
+      static std::string escape(const std::string& aValue);
+
+      void assignIds();
+      std::string qname(const Name& aName) const;
+      void writeAttributes(const Name& aElement, const ElementInfo& aInfo,
+                           std::ostream& aOut) const;
+
+      std::map<Name, ElementInfo> theElements;
+      std::map<Name, AttributeInfo> theAttributes;  // qualified ones only
+      // Unqualified attributes, per element
+      std::map<std::pair<Name, std::string>, AttributeInfo> theLocalAttributes;
+      std::vector<Frame> theStack;
+
+      // Filled in by assignIds()
+      std::vector<std::string> theNamespaces;
+      std::map<std::string, std::string> thePrefixes;
+      std::map<Name, uint64_t> theElementIds;
+      std::map<Name, uint64_t> theAttributeIds;
+      std::map<std::pair<Name, std::string>, uint64_t> theLocalAttributeIds;
+      bool theHasIds;
+  };
+
+}/*csx namespace*/}/*zorba namespace*/
+
+#endif //__COM_ZORBA_WWW_MODULES_CSX_VOCAB_GEN_H__
@@ -0,0 +1 @@
+4<r n="3"/>
\ No newline at end of file
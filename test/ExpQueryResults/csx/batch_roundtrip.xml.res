@@ -0,0 +1 @@
+3<a>1</a><b x="y">2</b><c><d/></c>
\ No newline at end of file
@@ -0,0 +1 @@
+20 20 20<a>b</a>
\ No newline at end of file
@@ -0,0 +1 @@
+CSX0005 CSX0005 CSX0005 CSX0005
\ No newline at end of file
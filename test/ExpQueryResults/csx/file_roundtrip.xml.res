@@ -0,0 +1 @@
+<a x="1"><b>text</b></a>
\ No newline at end of file
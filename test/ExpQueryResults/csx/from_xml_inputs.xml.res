@@ -0,0 +1 @@
+<a><b/></a><a><b/></a>true XPTY0004
\ No newline at end of file
@@ -0,0 +1 @@
+1 http://www.oracle.com/CSX/vocab/a Emp Name Emps xs:int
\ No newline at end of file
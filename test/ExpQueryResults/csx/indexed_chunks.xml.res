@@ -0,0 +1 @@
+10<r n="3"/><r n="4"/><r n="5"/><r n="10"/>
\ No newline at end of file
@@ -0,0 +1 @@
+6 6<b/><c/><d/>6
\ No newline at end of file
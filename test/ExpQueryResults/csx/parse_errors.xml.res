@@ -0,0 +1 @@
+CSX0005 a 3 b 3 c 3
\ No newline at end of file
@@ -0,0 +1 @@
+<r><a><b x="1">keep</b></a></r><r><a><b x="1">keep</b></a><d><b>2</b></d></r>
\ No newline at end of file
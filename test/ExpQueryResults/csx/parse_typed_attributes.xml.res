@@ -0,0 +1 @@
+true true x z
\ No newline at end of file
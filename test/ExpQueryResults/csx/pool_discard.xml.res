@@ -0,0 +1 @@
+CSX0005 1 -1 3
\ No newline at end of file
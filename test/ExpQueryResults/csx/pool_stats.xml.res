@@ -0,0 +1 @@
+2 0 3 3
\ No newline at end of file
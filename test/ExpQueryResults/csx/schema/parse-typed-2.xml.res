@@ -0,0 +1 @@
+true true true true true true true true true true true true
\ No newline at end of file
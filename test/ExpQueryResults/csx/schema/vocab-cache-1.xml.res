@@ -0,0 +1 @@
+16216f2a2c4fef78 true false
\ No newline at end of file
@@ -0,0 +1 @@
+<a n="1"/><b/><c/>
\ No newline at end of file
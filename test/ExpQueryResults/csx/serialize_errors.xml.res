@@ -0,0 +1 @@
+boom
\ No newline at end of file
@@ -0,0 +1 @@
+3 1 4 true true true
\ No newline at end of file
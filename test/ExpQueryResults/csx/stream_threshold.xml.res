@@ -0,0 +1 @@
+true short true true 16
\ No newline at end of file
@@ -0,0 +1 @@
+<r><p:a xmlns:p="urn:one" p:x="1" y="2"/><p:a xmlns:p="urn:one" p:x="3"><p:b/></p:a><p:a xmlns:p="urn:two" p:x="4"/><c z="5">text</c><p:a xmlns:p="urn:one"/></r>
\ No newline at end of file
@@ -0,0 +1 @@
+<a x="1"><b>t &amp; u</b><!--c--><?p d?></a>true
\ No newline at end of file